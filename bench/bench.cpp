@@ -0,0 +1,859 @@
+// Benchmarks for the mesh, shader, object and draw hot paths. Results go
+// to stdout (or --output) as JSON. The summary and anything the viewer
+// code prints go to stderr.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <GL/glew.h>
+
+#include <imgui.h>
+#include <imgui_impl_opengl3.h>
+
+#include "alloctrack.h"
+#include "arena.h"
+#include "expr.h"
+#include "frame.h"
+#include "framebuffer.h"
+#include "game.h"
+#include "jobs.h"
+#include "lod.h"
+#include "renderer.h"
+#include "separable.h"
+#include "shader.h"
+#include "softraster.h"
+#include "surface.h"
+#include "threadpool.h"
+
+#ifdef HEADLESS_EGL
+#include "headless.h"
+#endif
+
+#ifndef BENCH_BUILD_TYPE
+#define BENCH_BUILD_TYPE ""
+#endif
+
+typedef std::chrono::steady_clock Clock;
+typedef std::function<void ()> BenchBody;
+
+// Keeps the compiler from discarding a result it can prove unused
+template <typename T>
+static inline void DoNotOptimize(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Bench {
+    std::string name;
+    bool needs_gl;
+    // Runs once before timing and returns the measured body, so setup
+    // costs stay out of the results
+    std::function<BenchBody ()> setup;
+    // Stands for a steady-state frame, which --check-allocs expects to
+    // make no heap allocations
+    bool steady = false;
+};
+
+typedef std::vector<std::pair<std::string, double>> BenchMetrics;
+
+struct BenchResult {
+    std::string name;
+    unsigned long iterations;
+    double mean_ns, median_ns, min_ns, max_ns, stddev_ns;
+    // Per call, on every thread
+    double allocs, alloc_bytes;
+    BenchMetrics metrics;
+};
+
+// Measurements other than time, added by a benchmark's fixture as it is
+// torn down and attached to that benchmark's result
+static BenchMetrics bench_metrics;
+
+// Triangles drawn and the time spent drawing them, reported as a rate
+struct TriangleRate {
+    double triangles = 0, ns = 0;
+
+    ~TriangleRate()
+    {
+        if (ns)
+            bench_metrics.push_back({ "triangles_per_s", triangles / (ns * 1e-9) });
+    }
+};
+
+struct BenchOptions {
+    const char *filter = nullptr;
+    const char *output = nullptr;
+    double min_time = 0.5;
+    int width = 640, height = 360;
+    bool gl = true;
+    bool list = false;
+    bool check_allocs = false;
+};
+
+// Samples are batches of calls long enough to dwarf the clock overhead
+#define SAMPLE_TARGET_NS 1e6
+#define MIN_SAMPLES 5
+#define MAX_SAMPLES 1000
+#define STEADY_WARMUP 10
+
+static double ElapsedNs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+static BenchResult RunBench(const Bench &bench, const BenchBody &body, double min_time)
+{
+    // Warm caches and lazily created GL objects. Steady-state benchmarks
+    // also get the UI and pools to settle before allocations are counted.
+    Clock::time_point start;
+    for (unsigned i = 0; i < (bench.steady ? STEADY_WARMUP : 1); i++) {
+        start = Clock::now();
+        body();
+        FrameArena().reset();
+    }
+    double first_ns = std::max(ElapsedNs(start), 1.0);
+
+    unsigned long batch = std::max(1.0, SAMPLE_TARGET_NS / first_ns);
+    std::vector<double> samples;
+    double total_ns = 0;
+    AllocStats allocs_start = AllocTotalStats();
+    while (samples.size() < MAX_SAMPLES &&
+           (samples.size() < MIN_SAMPLES || total_ns < min_time * 1e9)) {
+        start = Clock::now();
+        // Every call stands for a frame, so transient data is dropped as a
+        // frame would drop it
+        for (unsigned long i = 0; i < batch; i++) {
+            body();
+            FrameArena().reset();
+        }
+        double ns = ElapsedNs(start);
+        total_ns += ns;
+        samples.push_back(ns / batch);
+    }
+    AllocStats allocs = AllocTotalStats() - allocs_start;
+
+    BenchResult result;
+    result.name = bench.name;
+    result.iterations = samples.size() * batch;
+    result.allocs = (double)allocs.count / result.iterations;
+    result.alloc_bytes = (double)allocs.bytes / result.iterations;
+
+    double sum = 0;
+    for (double s : samples)
+        sum += s;
+    result.mean_ns = sum / samples.size();
+
+    double var = 0;
+    for (double s : samples)
+        var += (s - result.mean_ns) * (s - result.mean_ns);
+    result.stddev_ns = sqrt(var / samples.size());
+
+    std::sort(samples.begin(), samples.end());
+    result.min_ns = samples.front();
+    result.max_ns = samples.back();
+    result.median_ns = samples[samples.size() / 2];
+    return result;
+}
+
+
+
+static std::string Named(const char *base, const char *param, long value)
+{
+    return std::string(base) + "/" + param + ":" + std::to_string(value);
+}
+
+static void AddMeshBenches(std::vector<Bench> *benches)
+{
+    // 64 is what an edit shows first
+    for (unsigned res : { 16, 64, 128, 512, 1000 }) {
+        benches->push_back({ Named("mesh/create_mesh", "res", res), false, [res]() -> BenchBody {
+            auto editor = std::make_shared<SurfaceEditor>(1);
+            editor->model_params.res_x = res;
+            editor->model_params.res_y = res;
+            return [editor]() {
+                Mesh mesh = editor->create_mesh(&ThreadPool::shared());
+                DoNotOptimize(mesh.vertices.data());
+            };
+        }});
+    }
+}
+
+static void AddShaderBenches(std::vector<Bench> *benches)
+{
+    benches->push_back({ "shader/parse_equation", false, []() -> BenchBody {
+        return []() {
+            auto expr = Expr::parse(Equations().y);
+            DoNotOptimize(expr);
+        };
+    }});
+
+    benches->push_back({ "shader/analyze_separable", false, []() -> BenchBody {
+        return []() {
+            Equations eqs;
+            SeparablePlan plan = SeparablePlan::analyze(eqs.x, eqs.y, eqs.z);
+            DoNotOptimize(plan.rows.data());
+        };
+    }});
+
+    benches->push_back({ "shader/create_shader", true, []() -> BenchBody {
+        auto editor = std::make_shared<SurfaceEditor>(1);
+        return [editor]() {
+            auto shader = editor->create_shader();
+            DoNotOptimize(shader);
+        };
+    }});
+}
+
+// Objects outside of a GameState, destroyed before their world
+struct BenchWorld {
+    World world;
+    std::vector<Object> objects;
+};
+
+static void AddObjectBenches(std::vector<Bench> *benches)
+{
+    auto make_object = [](World *world) {
+        Object obj(world);
+        obj.add_component(Mesh({}, {}));
+        obj.add_component(Renderer(std::nullopt));
+        return obj;
+    };
+
+    benches->push_back({ "object/component_hit", false, [make_object]() -> BenchBody {
+        auto scene = std::make_shared<BenchWorld>();
+        scene->objects.push_back(make_object(&scene->world));
+        return [scene]() {
+            auto comp = scene->objects[0].component<Renderer>();
+            DoNotOptimize(comp);
+        };
+    }});
+
+    benches->push_back({ "object/component_miss", false, [make_object]() -> BenchBody {
+        auto scene = std::make_shared<BenchWorld>();
+        scene->objects.push_back(make_object(&scene->world));
+        return [scene]() {
+            auto comp = scene->objects[0].component<SurfaceEditor>();
+            DoNotOptimize(comp);
+        };
+    }});
+
+    for (unsigned count : { 1000, 10000 }) {
+        benches->push_back({ Named("object/view", "objects", count), false, [make_object, count]() -> BenchBody {
+            auto scene = std::make_shared<BenchWorld>();
+            for (unsigned i = 0; i < count; i++)
+                scene->objects.push_back(make_object(&scene->world));
+            return [scene]() {
+                unsigned found = 0;
+                ForEachComponent<Renderer, Mesh>(&scene->world, [&](Object &, Renderer &, Mesh &mesh) {
+                    found += mesh.indices.size() + 1;
+                });
+                DoNotOptimize(found);
+            };
+        }});
+    }
+
+    for (unsigned count : { 10, 1000, 10000 }) {
+        benches->push_back({ Named("update", "objects", count), false, [make_object, count]() -> BenchBody {
+            auto ctx = std::make_shared<GameState>();
+            for (unsigned i = 0; i < count; i++)
+                ctx->add_object(make_object(&ctx->world));
+            return [ctx]() {
+                Update(ctx.get(), 1.f / 60.f);
+            };
+        }, true });
+    }
+
+    benches->push_back({ "object/add_remove/objects:10000", false, [make_object]() -> BenchBody {
+        auto ctx = std::make_shared<GameState>();
+        auto handles = std::make_shared<std::vector<ObjectHandle>>();
+        for (unsigned i = 0; i < 10000; i++)
+            handles->push_back(ctx->add_object(make_object(&ctx->world)));
+        auto next = std::make_shared<size_t>(0);
+        return [ctx, handles, next, make_object]() {
+            // Replace the oldest object, so the map stays at 10k
+            size_t i = (*next)++ % handles->size();
+            ctx->objects.erase((*handles)[i]);
+            (*handles)[i] = ctx->add_object(make_object(&ctx->world));
+        };
+    }});
+}
+
+// Remeshing every surface at once in the background, as a tessellation
+// change does
+static void AddJobBenches(std::vector<Bench> *benches)
+{
+    auto remesh = [](JobScheduler *jobs, uint64_t key) {
+        Job job;
+        job.name = "Remesh";
+        job.key = key;
+        job.work = [](const CancelToken &cancel) {
+            ModelParams params;
+            params.res_x = params.res_y = 250;
+            Mesh mesh = CreateGridMesh(params, &ThreadPool::shared(), &cancel);
+            DoNotOptimize(mesh.vertices.data());
+            return MainStep();
+        };
+        jobs->submit(std::move(job));
+    };
+
+    for (unsigned count : { 1, 16 }) {
+        benches->push_back({ Named("jobs/remesh", "surfaces", count), false, [count, remesh]() -> BenchBody {
+            auto jobs = std::make_shared<JobScheduler>();
+            return [jobs, count, remesh]() {
+                for (unsigned i = 0; i < count; i++)
+                    remesh(jobs.get(), i + 1);
+                jobs->finish();
+            };
+        }});
+    }
+
+    // One surface edited every frame, where only the last edit is meshed
+    benches->push_back({ "jobs/coalesce/edits:16", false, [remesh]() -> BenchBody {
+        auto jobs = std::make_shared<JobScheduler>();
+        return [jobs, remesh]() {
+            for (unsigned i = 0; i < 16; i++)
+                remesh(jobs.get(), 1);
+            jobs->finish();
+        };
+    }});
+}
+
+// The same work on pools of 1 to N threads, counting the caller
+static void AddScalingBenches(std::vector<Bench> *benches)
+{
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n < cores; n *= 2)
+        counts.push_back(n);
+    counts.push_back(cores);
+
+    for (unsigned threads : counts) {
+        benches->push_back({ Named("scaling/create_mesh", "threads", threads), false, [threads]() -> BenchBody {
+            auto pool = std::make_shared<ThreadPool>(threads - 1);
+            auto editor = std::make_shared<SurfaceEditor>(1);
+            editor->model_params.res_x = editor->model_params.res_y = 1000;
+            return [pool, editor]() {
+                Mesh mesh = editor->create_mesh(pool.get());
+                DoNotOptimize(mesh.vertices.data());
+            };
+        }});
+
+        // Compute-bound, like software shading
+        benches->push_back({ Named("scaling/eval", "threads", threads), false, [threads]() -> BenchBody {
+            auto pool = std::make_shared<ThreadPool>(threads - 1);
+            auto expr = std::make_shared<ExprRef>(Expr::parse(Equations().y).value());
+            auto out = std::make_shared<std::vector<float>>(512 * 512);
+            return [pool, expr, out]() {
+                pool->parallel_for(out->size(), 1024, [&](size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++)
+                        (*out)[i] = (*expr)->eval((i % 512) / 64.f, (i / 512) / 64.f, 0.f);
+                });
+                DoNotOptimize(out->data());
+            };
+        }});
+
+        // Binning and tile rasterization of a shaded surface, the software
+        // renderer's per-frame work once shading is cached
+        benches->push_back({ Named("scaling/software_raster", "threads", threads), false, [threads]() -> BenchBody {
+            auto pool = std::make_shared<ThreadPool>(threads - 1);
+            auto raster = std::make_shared<SoftRasterizer>(pool.get());
+            SurfaceEditor editor(1);
+            editor.model_params.res_x = editor.model_params.res_y = 500;
+            Mesh mesh = editor.create_mesh(pool.get());
+            SoftShader shader = editor.create_soft_shader().value();
+
+            glm::mat4 mvp = glm::perspective((float)M_PI / 4, 16.f / 9.f, 0.1f, 1000.f) *
+                glm::lookAt(glm::vec3(7.f, 5.f, 7.f), glm::vec3(0.f), glm::vec3(0, 1, 0));
+            auto verts = std::make_shared<std::vector<SoftVertex>>(mesh.vertices.size());
+            for (size_t i = 0; i < mesh.vertices.size(); i++) {
+                glm::vec3 pos;
+                shader(mesh.vertices[i], 0.f, &pos, &(*verts)[i].color);
+                (*verts)[i].clip = mvp * glm::vec4(pos, 1.f);
+            }
+            auto indices = std::make_shared<std::vector<VIndices>>(std::move(mesh.indices));
+            auto rate = std::make_shared<TriangleRate>();
+
+            return [pool, raster, verts, indices, rate]() {
+                Clock::time_point start = Clock::now();
+                raster->begin_frame(1280, 720);
+                raster->submit(*verts, *indices);
+                raster->end_frame();
+                rate->ns += ElapsedNs(start);
+                rate->triangles += indices->size();
+                DoNotOptimize(raster->color.data());
+            };
+        }});
+
+        // Independent remeshes as graph tasks, each splitting further
+        benches->push_back({ Named("scaling/graph", "threads", threads), false, [threads]() -> BenchBody {
+            auto pool = std::make_shared<ThreadPool>(threads - 1);
+            auto editors = std::make_shared<std::vector<SurfaceEditor>>();
+            for (unsigned i = 0; i < 16; i++) {
+                editors->emplace_back(i + 1);
+                editors->back().model_params.res_x = editors->back().model_params.res_y = 250;
+            }
+            auto graph = std::make_shared<TaskGraph>();
+            for (SurfaceEditor &editor : *editors) {
+                SurfaceEditor *target = &editor;
+                ThreadPool *on = pool.get();
+                graph->add([target, on]() {
+                    Mesh mesh = target->create_mesh(on);
+                    DoNotOptimize(mesh.vertices.data());
+                });
+            }
+            return [pool, editors, graph]() {
+                graph->run(pool.get());
+            };
+        }});
+    }
+}
+
+// Keeps a scene alive for as long as its bench body
+struct SceneFixture {
+    GameState ctx;
+    std::optional<Framebuffer> target;
+    SoftRasterizer soft_raster { &ThreadPool::shared() };
+};
+
+static std::shared_ptr<SceneFixture> MakeScene(RenderBackend backend, unsigned res, int width, int height)
+{
+    render_backend = backend;
+
+    auto scene = std::make_shared<SceneFixture>();
+    GameState *ctx = &scene->ctx;
+    ctx->soft_raster = &scene->soft_raster;
+    ctx->time = 0.f;
+    ctx->dt = 1.f / 60.f;
+    if (backend == RenderBackend::GL)
+        scene->target.emplace(width, height);
+
+    SetupScene(ctx, width, height);
+    ctx->jobs.synchronous = true;
+
+    for (Object &obj : ctx->objects) {
+        auto editor = obj.component<SurfaceEditor>();
+        if (!editor)
+            continue;
+        editor->get().model_params.res_x = res;
+        editor->get().model_params.res_y = res;
+        obj.component<Mesh>()->get() = editor->get().create_mesh(&ThreadPool::shared());
+        editor->get().mesh_params = editor->get().grid_params();
+        editor->get().refresh_shader(&obj);
+    }
+    return scene;
+}
+
+// An edit from its coarse preview through every refinement
+static void AddRefineBenches(std::vector<Bench> *benches, const BenchOptions &opts)
+{
+    int width = opts.width, height = opts.height;
+    benches->push_back({ "jobs/refine/res:1000", false, [=]() -> BenchBody {
+        auto scene = MakeScene(RenderBackend::Software, 1000, width, height);
+        return [scene]() {
+            GameState *ctx = &scene->ctx;
+            for (Object &obj : ctx->objects) {
+                if (auto editor = obj.component<SurfaceEditor>())
+                    editor->get().queue_remesh(ctx, &obj, true);
+            }
+            ctx->jobs.finish();
+        };
+    }});
+}
+
+// A camera circling a surface as it closes in, picking patches every frame
+// and rewriting the ones that change
+static void AddLodBenches(std::vector<Bench> *benches)
+{
+    for (unsigned patches : { 256, 1024 }) {
+        benches->push_back({ Named("lod/orbit", "patches", patches), false, [patches]() -> BenchBody {
+            Equations eqs;
+            auto tree = std::make_shared<PatchTree>();
+            tree->set_equations(eqs.x, eqs.y, eqs.z, true);
+            tree->reset(-3, 3, -3, 3);
+            auto mesh = std::make_shared<Mesh>(std::vector<Vertex>(), std::vector<VIndices>());
+            auto frame = std::make_shared<unsigned>(0);
+            return [tree, mesh, frame, patches]() {
+                LodParams params;
+                params.adaptive = true;
+                params.max_patches = patches;
+
+                float angle = (*frame % 600) * 0.01f;
+                float radius = 8.f - (*frame % 600) * 0.01f;
+                (*frame)++;
+                glm::mat4 projection = glm::perspective((float)M_PI / 4, 16.f / 9.f, 0.1f, 1000.f);
+                LodView view;
+                view.eye = glm::vec3(radius * cosf(angle), radius / 2, radius * sinf(angle));
+                view.view_proj = projection * glm::lookAt(view.eye, glm::vec3(0.f), glm::vec3(0, 1, 0));
+                view.pixels_per_unit = projection[1][1] * 1080 / 2.f;
+
+                if (tree->update(view, params, angle)) {
+                    mesh->dirty_ranges.clear();
+                    tree->build(&mesh->vertices, &mesh->indices, &mesh->dirty_ranges, &ThreadPool::shared());
+                }
+                DoNotOptimize(mesh->vertices.data());
+            };
+        }});
+    }
+}
+
+// A surface remeshed every frame: its new buffers come out of the pool,
+// and the old ones go back once the GPU is done with them
+static void AddBufferBenches(std::vector<Bench> *benches)
+{
+    for (unsigned mb : { 1, 16 }) {
+        benches->push_back({ Named("gpu/buffer_pool/remesh", "mb", mb), true, [mb]() -> BenchBody {
+            auto pool = std::make_shared<GpuBufferPool>();
+            auto data = std::make_shared<std::vector<char>>((size_t)mb << 20);
+            auto vao = std::make_shared<VertArrayObj>();
+            return [pool, data, vao]() {
+                vao->release(pool.get());
+                vao->reserve(pool.get(), data->size(), 0);
+                vao->write_vertices(0, data->data(), data->size());
+                pool->end_frame();
+                glFinish();
+            };
+        }});
+    }
+}
+
+static void AddDrawBenches(std::vector<Bench> *benches, const BenchOptions &opts)
+{
+    int width = opts.width, height = opts.height;
+
+    for (unsigned res : { 100, 500 }) {
+        benches->push_back({ Named("draw/gl", "res", res), true, [=]() -> BenchBody {
+            auto scene = MakeScene(RenderBackend::GL, res, width, height);
+            return [scene]() {
+                scene->target->bind();
+                DrawFrame(&scene->ctx);
+                glFinish();
+                scene->ctx.time += scene->ctx.dt;
+            };
+        }});
+
+        benches->push_back({ Named("draw/software", "res", res), false, [=]() -> BenchBody {
+            auto scene = MakeScene(RenderBackend::Software, res, width, height);
+            auto rate = std::make_shared<TriangleRate>();
+            for (Object &obj : scene->ctx.objects) {
+                if (auto mesh = obj.component<Mesh>())
+                    rate->triangles += mesh->get().indices.size();
+            }
+            double triangles = rate->triangles;
+            rate->triangles = 0;
+            return [scene, rate, triangles]() {
+                Clock::time_point start = Clock::now();
+                DrawFrame(&scene->ctx);
+                rate->ns += ElapsedNs(start);
+                rate->triangles += triangles;
+                scene->ctx.time += scene->ctx.dt;
+            };
+        }, true });
+    }
+}
+
+// A whole frame with the UI, as the main loop runs it minus the
+// platform's event handling and presentation
+struct FrameFixture {
+    ImGuiContext *imgui;
+    std::shared_ptr<SceneFixture> scene;
+    bool gl;
+
+    FrameFixture(RenderBackend backend, unsigned res, int width, int height):
+        gl(backend == RenderBackend::GL)
+    {
+        imgui = ImGui::CreateContext();
+        ImGuiIO &io = ImGui::GetIO();
+        io.IniFilename = nullptr;
+        io.DisplaySize = ImVec2((float)width, (float)height);
+        io.DeltaTime = 1.f / 60.f;
+        if (gl) {
+            ImGui_ImplOpenGL3_Init("#version 300 es");
+        } else {
+            unsigned char *pixels;
+            int font_w, font_h;
+            io.Fonts->GetTexDataAsRGBA32(&pixels, &font_w, &font_h);
+        }
+
+        scene = MakeScene(backend, res, width, height);
+        scene->ctx.imgui_io = &io;
+    }
+
+    ~FrameFixture()
+    {
+        LatencyTracker &latency = scene->ctx.latency;
+        if (latency.synthetic_period) {
+            latency.collect(true);
+            for (unsigned i = 0; i < LatencyTracker::STAGES; i++) {
+                std::string stage = LatencyTracker::stage_name((LatencyTracker::Stage)i);
+                std::replace(stage.begin(), stage.end(), ' ', '_');
+                const LatencyTracker::Distribution &dist = latency.stages[i];
+                if (!dist.count)
+                    continue;
+                bench_metrics.push_back({ "latency_" + stage + "_p50_ms", dist.percentile(0.50f) });
+                bench_metrics.push_back({ "latency_" + stage + "_p95_ms", dist.percentile(0.95f) });
+            }
+        }
+
+        scene.reset();
+        if (gl)
+            ImGui_ImplOpenGL3_Shutdown();
+        ImGui::DestroyContext(imgui);
+    }
+
+    void run()
+    {
+        GameState *ctx = &scene->ctx;
+        ctx->cpu_profiler.begin_frame();
+        if (gl) {
+            scene->target->bind();
+            ImGui_ImplOpenGL3_NewFrame();
+        }
+        RenderFrame(ctx);
+        ctx->latency.mark(LatencyTracker::Presented);
+        ctx->latency.end_frame();
+        ctx->cpu_profiler.end_frame();
+        ctx->time += ctx->dt;
+    }
+};
+
+static void AddFrameBenches(std::vector<Bench> *benches, const BenchOptions &opts)
+{
+    int width = opts.width, height = opts.height;
+
+    benches->push_back({ "frame/software/res:100", false, [=]() -> BenchBody {
+        auto frame = std::make_shared<FrameFixture>(RenderBackend::Software, 100, width, height);
+        return [frame]() {
+            frame->run();
+        };
+    }, true });
+
+    // Presses or releases a key every frame and reports how long each
+    // input took to get through the frame
+    for (RenderBackend backend : { RenderBackend::GL, RenderBackend::Software }) {
+        bool gl = backend == RenderBackend::GL;
+        benches->push_back({ gl ? "latency/gl/res:100" : "latency/software/res:100", gl, [=]() -> BenchBody {
+            auto frame = std::make_shared<FrameFixture>(backend, 100, width, height);
+            frame->scene->ctx.latency.synthetic_period = 1;
+            return [frame]() {
+                frame->run();
+            };
+        }});
+    }
+}
+
+// Quoted, with anything JSON doesn't allow in a string escaped
+static void WriteJsonString(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for (const char *c = str; *c; c++) {
+        switch (*c) {
+        case '"':   fputs("\\\"", file); break;
+        case '\\':  fputs("\\\\", file); break;
+        case '\n':  fputs("\\n", file); break;
+        case '\t':  fputs("\\t", file); break;
+        default:
+            if ((unsigned char)*c < 0x20)
+                fprintf(file, "\\u%04x", (unsigned char)*c);
+            else
+                fputc(*c, file);
+            break;
+        }
+    }
+    fputc('"', file);
+}
+
+static void WriteJson(FILE *file, const std::vector<BenchResult> &results, const BenchOptions &opts, const char *gl_renderer)
+{
+    fprintf(file, "{\n");
+    fprintf(file, "  \"context\": {\n");
+    fprintf(file, "    \"build_type\": ");
+    WriteJsonString(file, BENCH_BUILD_TYPE);
+    fprintf(file, ",\n    \"compiler\": ");
+    WriteJsonString(file, __VERSION__);
+    fprintf(file, ",\n    \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+    fprintf(file, "    \"gl_renderer\": ");
+    if (gl_renderer)
+        WriteJsonString(file, gl_renderer);
+    else
+        fprintf(file, "null");
+    fprintf(file, ",\n");
+    fprintf(file, "    \"min_time_s\": %g,\n", opts.min_time);
+    fprintf(file, "    \"draw_size\": [%d, %d]\n", opts.width, opts.height);
+    fprintf(file, "  },\n");
+
+    fprintf(file, "  \"benchmarks\": [");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        fprintf(file, "%s\n    {\"name\": ", i ? "," : "");
+        WriteJsonString(file, r.name.c_str());
+        fprintf(file, ", \"iterations\": %lu, \"mean_ns\": %.1f, \"median_ns\": %.1f, "
+            "\"min_ns\": %.1f, \"max_ns\": %.1f, \"stddev_ns\": %.1f, \"allocs\": %.2f, \"alloc_bytes\": %.1f",
+            r.iterations, r.mean_ns, r.median_ns, r.min_ns, r.max_ns, r.stddev_ns,
+            r.allocs, r.alloc_bytes);
+        if (!r.metrics.empty()) {
+            fprintf(file, ", \"metrics\": {");
+            for (size_t j = 0; j < r.metrics.size(); j++) {
+                fprintf(file, "%s", j ? ", " : "");
+                WriteJsonString(file, r.metrics[j].first.c_str());
+                fprintf(file, ": %.4f", r.metrics[j].second);
+            }
+            fprintf(file, "}");
+        }
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  ]\n}\n");
+}
+
+static void PrintUsage(const char *argv0)
+{
+    printf("Usage: %s [options]\n", argv0);
+    printf("  --filter TEXT       Only run benchmarks whose name contains TEXT\n");
+    printf("  --list              List benchmark names and exit\n");
+    printf("  --min-time SECONDS  Minimum time spent in each benchmark (default 0.5)\n");
+    printf("  --size WxH          Framebuffer size of the draw benchmarks (default 640x360)\n");
+    printf("  --no-gl             Skip benchmarks that need a GL context\n");
+    printf("  --output PATH       Write JSON results here instead of stdout\n");
+    printf("  --check-allocs      Fail if a steady-state frame benchmark allocates\n");
+}
+
+static bool ParseOptions(int argc, char **argv, BenchOptions *opts)
+{
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (!strcmp(arg, "--filter") && val) {
+            opts->filter = val;
+            i++;
+        } else if (!strcmp(arg, "--list")) {
+            opts->list = true;
+        } else if (!strcmp(arg, "--min-time") && val) {
+            opts->min_time = strtod(val, nullptr);
+            i++;
+        } else if (!strcmp(arg, "--size") && val) {
+            if (sscanf(val, "%dx%d", &opts->width, &opts->height) != 2)
+                return false;
+            i++;
+        } else if (!strcmp(arg, "--no-gl")) {
+            opts->gl = false;
+        } else if (!strcmp(arg, "--output") && val) {
+            opts->output = val;
+            i++;
+        } else if (!strcmp(arg, "--check-allocs")) {
+            opts->check_allocs = true;
+        } else {
+            return false;
+        }
+    }
+    if (opts->check_allocs && !AllocTrackingEnabled()) {
+        printf("This build has no allocation tracking, configure with -DALLOC_TRACKING=ON!\n");
+        return false;
+    }
+    return opts->width > 0 && opts->height > 0 && opts->min_time >= 0;
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions opts;
+    if (!ParseOptions(argc, argv, &opts)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // Keep stdout for the results alone
+    FILE *file = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    std::vector<Bench> benches;
+    AddMeshBenches(&benches);
+    AddShaderBenches(&benches);
+    AddObjectBenches(&benches);
+    AddJobBenches(&benches);
+    AddScalingBenches(&benches);
+    AddBufferBenches(&benches);
+    AddRefineBenches(&benches, opts);
+    AddLodBenches(&benches);
+    AddDrawBenches(&benches, opts);
+    AddFrameBenches(&benches, opts);
+
+    if (opts.list) {
+        for (const Bench &bench : benches)
+            fprintf(file, "%s%s%s\n", bench.name.c_str(), bench.needs_gl ? " (gl)" : "",
+                bench.steady ? " (steady)" : "");
+        return 0;
+    }
+
+    // Compile every shader for real on every run
+    setenv("MESA_SHADER_CACHE_DISABLE", "true", 1);
+
+#ifdef HEADLESS_EGL
+    std::optional<HeadlessContext> egl;
+    if (opts.gl) {
+        egl = HeadlessContext::create();
+        if (!egl) {
+            printf("Failed to create a headless GL context, rerun with --no-gl!\n");
+            return 1;
+        }
+    }
+#else
+    opts.gl = false;
+#endif
+    const char *gl_renderer = opts.gl ? (const char *)glGetString(GL_RENDERER) : nullptr;
+
+    std::vector<BenchResult> results;
+    unsigned alloc_failures = 0;
+    for (const Bench &bench : benches) {
+        if (opts.filter && !strstr(bench.name.c_str(), opts.filter))
+            continue;
+        if (bench.needs_gl && !opts.gl) {
+            fprintf(stderr, "%-32s skipped, no GL\n", bench.name.c_str());
+            continue;
+        }
+
+        BenchResult result;
+        bench_metrics.clear();
+        {
+            BenchBody body = bench.setup();
+            result = RunBench(bench, body, opts.min_time);
+        }
+        result.metrics = bench_metrics;
+        render_backend = RenderBackend::GL;
+
+        fprintf(stderr, "%-32s %12.0f ns median %12.0f ns mean +- %.1f%% (%lu iterations)\n",
+            result.name.c_str(), result.median_ns, result.mean_ns,
+            result.mean_ns ? 100 * result.stddev_ns / result.mean_ns : 0.0, result.iterations);
+        for (const auto &metric : result.metrics)
+            fprintf(stderr, "    %-36s %10.3f\n", metric.first.c_str(), metric.second);
+        if (opts.check_allocs && bench.steady && result.allocs > 0) {
+            fprintf(stderr, "%-32s made %.2f allocations (%.0f bytes) per frame!\n",
+                result.name.c_str(), result.allocs, result.alloc_bytes);
+            alloc_failures++;
+        }
+        results.push_back(result);
+    }
+
+    if (opts.output) {
+        fclose(file);
+        file = fopen(opts.output, "w");
+        if (!file) {
+            printf("Could not open `%s` for writing!\n", opts.output);
+            return 1;
+        }
+    }
+    WriteJson(file, results, opts, gl_renderer);
+    fclose(file);
+
+    return alloc_failures ? 1 : 0;
+}
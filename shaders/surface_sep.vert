@@ -0,0 +1,51 @@
+#version 300 es
+layout (location = 0) in vec3 i_pos;
+layout (location = 1) in vec2 i_texpos;
+
+precision mediump float;
+
+uniform mat4 u_model;
+uniform mat4 u_view;
+uniform mat4 u_proj;
+uniform float u_time;
+
+// Rows of single-variable factors, sampled once per grid line
+uniform highp sampler2D u_lut;
+// xy: (u, v) at grid index 0, zw: step per grid index
+uniform vec4 u_grid;
+uniform ivec2 u_grid_max;
+
+out vec2 texpos;
+out vec3 normal;
+
+float lut(int i, int row)
+{
+    return texelFetch(u_lut, ivec2(i, row), 0).r;
+}
+
+vec3 fn(ivec2 ij)
+{
+    ij = clamp(ij, ivec2(0), u_grid_max);
+    float u = u_grid.x + float(ij.x) * u_grid.z;
+    float v = u_grid.y + float(ij.y) * u_grid.w;
+    float t = u_time;
+    __INCLUDE_XYZ__
+    return vec3(x, y, z);
+}
+
+vec3 fn_normal(ivec2 ij)
+{
+    vec3 df_du = fn(ij + ivec2(1, 0)) - fn(ij - ivec2(1, 0));
+    vec3 df_dv = fn(ij + ivec2(0, 1)) - fn(ij - ivec2(0, 1));
+    vec3 normal_unnormalized = cross(df_du, df_dv);
+    return normalize(normal_unnormalized) * 0.5 + 0.5;
+}
+
+void main()
+{
+    ivec2 ij = ivec2(i_texpos);
+    mat4 mvp = u_proj * u_view * u_model;
+    gl_Position = mvp * vec4(fn(ij), 1.0);
+    normal = fn_normal(ij);
+    texpos = i_texpos;
+}
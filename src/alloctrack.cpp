@@ -0,0 +1,123 @@
+#include "alloctrack.h"
+
+#ifdef ALLOC_TRACKING
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Everything here may run before main() and inside any thread, so it only
+// touches zero-initialized thread locals and atomics
+static thread_local AllocStats thread_stats;
+static std::atomic<uint64_t> total_count = 0;
+static std::atomic<uint64_t> total_bytes = 0;
+
+static void Count(size_t size)
+{
+    thread_stats.count++;
+    thread_stats.bytes += size;
+    total_count.fetch_add(1, std::memory_order_relaxed);
+    total_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+AllocStats AllocThreadStats()
+{
+    return thread_stats;
+}
+
+AllocStats AllocTotalStats()
+{
+    return { total_count.load(std::memory_order_relaxed), total_bytes.load(std::memory_order_relaxed) };
+}
+
+#if defined(__GLIBC__) && !defined(__EMSCRIPTEN__)
+// operator new goes through malloc, which is counted here
+#define INTERPOSE_MALLOC
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) noexcept
+{
+    Count(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+    Count(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept
+{
+    Count(size);
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+static void *Allocate(size_t size)
+{
+#ifndef INTERPOSE_MALLOC
+    Count(size);
+#endif
+    return malloc(size ? size : 1);
+}
+
+static void *AllocateAligned(size_t size, size_t align)
+{
+    // aligned_alloc isn't interposed, so count it either way
+    Count(size);
+    size_t rounded = (size + align - 1) / align * align;
+    return aligned_alloc(align, rounded ? rounded : align);
+}
+
+void *operator new(size_t size)
+{
+    void *ptr = Allocate(size);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return Allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return Allocate(size);
+}
+
+void *operator new(size_t size, std::align_val_t align)
+{
+    void *ptr = AllocateAligned(size, (size_t)align);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size, std::align_val_t align)
+{
+    return operator new(size, align);
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { free(ptr); }
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts heap allocations through a replaced operator new and, on glibc,
+// an interposed malloc, so allocations made by stb, ImGui and other C code
+// are seen too. Configure with -DALLOC_TRACKING=OFF to compile it out,
+// which is also needed under sanitizers that bring their own malloc.
+
+struct AllocStats {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+
+    AllocStats operator-(const AllocStats &other) const
+    {
+        return { count - other.count, bytes - other.bytes };
+    }
+};
+
+#ifdef ALLOC_TRACKING
+
+// Made by the calling thread so far
+AllocStats AllocThreadStats();
+// Made by every thread so far
+AllocStats AllocTotalStats();
+
+inline bool AllocTrackingEnabled()
+{
+    return true;
+}
+
+#else
+
+inline AllocStats AllocThreadStats() { return {}; }
+inline AllocStats AllocTotalStats() { return {}; }
+inline bool AllocTrackingEnabled() { return false; }
+
+#endif
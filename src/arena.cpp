@@ -0,0 +1,51 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+Arena::~Arena()
+{
+    for (Block &b : blocks)
+        free(b.data);
+}
+
+void *Arena::alloc(size_t size, size_t align)
+{
+    for (;;) {
+        if (block < blocks.size()) {
+            Block &b = blocks[block];
+            uintptr_t base = (uintptr_t)b.data;
+            size_t start = ((base + offset + align - 1) & ~(uintptr_t)(align - 1)) - base;
+            if (start + size <= b.size) {
+                offset = start + size;
+                used_bytes += size;
+                return b.data + start;
+            }
+            if (block + 1 < blocks.size()) {
+                block++;
+                offset = 0;
+                continue;
+            }
+        }
+
+        // Oversized requests get a block of their own
+        size_t block_size = std::max(BLOCK_SIZE, size + align);
+        blocks.push_back({ (char *)malloc(block_size), block_size });
+        block = blocks.size() - 1;
+        offset = 0;
+    }
+}
+
+void Arena::reset()
+{
+    block = 0;
+    offset = 0;
+    used_bytes = 0;
+}
+
+Arena &FrameArena()
+{
+    static Arena arena;
+    return arena;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Bump allocator for data that only lives until the end of the frame.
+// Blocks are kept across resets, so once the arena has grown to a frame's
+// working size a steady frame allocates nothing from the heap.
+struct Arena {
+    static constexpr size_t BLOCK_SIZE = 64 << 10;
+
+    Arena() = default;
+    Arena(const Arena &other) = delete;
+    ~Arena();
+
+    void *alloc(size_t size, size_t align);
+    // Everything allocated so far becomes invalid
+    void reset();
+
+    size_t used() const
+    {
+        return used_bytes;
+    }
+
+private:
+    struct Block {
+        char *data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t block = 0;
+    size_t offset = 0;
+    size_t used_bytes = 0;
+};
+
+// Main thread only, reset once the frame has been presented
+Arena &FrameArena();
+
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    Arena *arena;
+
+    ArenaAllocator(Arena *arena = &FrameArena()):
+        arena(arena)
+    {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other):
+        arena(other.arena)
+    {
+    }
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(arena->alloc(n * sizeof(T), alignof(T)));
+    }
+
+    // Freed all at once by the reset
+    void deallocate(T *, size_t)
+    {
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const
+    {
+        return arena == other.arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const
+    {
+        return arena != other.arena;
+    }
+};
+
+// Transient containers, which must not outlive the frame they were made in
+template <typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> FrameString;
@@ -65,13 +65,15 @@ static Mesh create_mesh()
     return Mesh(vertices, indices);
 }
 
-Object CreateAxes()
+Object CreateAxes(World *world)
 {
-    Object obj;
+    Object obj(world);
 
     Mesh mesh = create_mesh();
-    ShaderProgram shader = create_shader().value();
-    Renderer renderer(std::move(shader));
+    Renderer renderer(std::nullopt);
+    renderer.label = "Axes";
+    if (render_backend == RenderBackend::GL)
+        renderer.shader = create_shader().value();
 
     obj.add_component(std::move(renderer));
     obj.add_component(std::move(mesh));
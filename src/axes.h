@@ -2,4 +2,4 @@
 
 #include "object.h"
 
-Object CreateAxes();
\ No newline at end of file
+Object CreateAxes(World *world);
\ No newline at end of file
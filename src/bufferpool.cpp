@@ -0,0 +1,210 @@
+#include "bufferpool.h"
+
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include <imgui.h>
+
+#include "trace.h"
+
+// Four buckets to every doubling, so rounding up wastes at most a fifth
+static size_t BucketSize(size_t bytes, unsigned *bucket)
+{
+    size_t base = GpuBufferPool::MIN_BUCKET;
+    unsigned index = 0;
+    while (base * 2 < bytes && index + 4 < GpuBufferPool::BUCKETS) {
+        base *= 2;
+        index += 4;
+    }
+
+    if (bytes <= base) {
+        *bucket = index;
+        return base;
+    }
+    size_t quarter = base / 4;
+    size_t steps = (bytes - base + quarter - 1) / quarter;
+    *bucket = std::min<size_t>(index + steps, GpuBufferPool::BUCKETS - 1);
+    return base + steps * quarter;
+}
+
+// Element array bindings belong to the bound VAO, so index buffers are
+// filled through the copy target
+static GLenum BufferTarget(BufferKind kind)
+{
+    return kind == BufferKind::Vertex ? GL_ARRAY_BUFFER : GL_COPY_WRITE_BUFFER;
+}
+
+GpuBufferPool::~GpuBufferPool()
+{
+    clear();
+}
+
+GpuBuffer GpuBufferPool::acquire(BufferKind kind, size_t bytes)
+{
+    unsigned bucket;
+    size_t capacity = BucketSize(bytes, &bucket);
+    GLenum target = BufferTarget(kind);
+
+    GpuBuffer buffer;
+    std::vector<FreeBuffer> &bucket_free = free_lists[(size_t)kind][bucket];
+    if (!bucket_free.empty() && bucket_free.back().buffer.capacity >= bytes) {
+        // The most recently released is the most likely to still be resident
+        buffer = bucket_free.back().buffer;
+        bucket_free.pop_back();
+        current.free -= buffer.capacity;
+        current.reused++;
+    } else {
+        // Rather than making another, give the GPU new storage behind one
+        // it may still be reading
+        for (Retired &batch : retired) {
+            for (size_t i = 0; i < batch.buffers.size(); i++) {
+                GpuBuffer &waiting = batch.buffers[i];
+                if (waiting.kind != kind || waiting.capacity != capacity)
+                    continue;
+                buffer = waiting;
+                batch.buffers[i] = batch.buffers.back();
+                batch.buffers.pop_back();
+                break;
+            }
+            if (buffer.id)
+                break;
+        }
+
+        if (buffer.id) {
+            current.waiting -= buffer.capacity;
+            current.orphaned++;
+        } else {
+            buffer.kind = kind;
+            buffer.capacity = capacity;
+            glGenBuffers(1, &buffer.id);
+            current.buffers++;
+            current.allocated += capacity;
+            current.high_water = std::max(current.high_water, current.allocated);
+            current.created++;
+        }
+        glBindBuffer(target, buffer.id);
+        glBufferData(target, buffer.capacity, nullptr, GL_STATIC_DRAW);
+    }
+
+    buffer.size = bytes;
+    current.in_use += buffer.capacity;
+    current.requested += bytes;
+    return buffer;
+}
+
+void GpuBufferPool::release(GpuBuffer *buffer)
+{
+    if (!buffer->id)
+        return;
+    current.in_use -= buffer->capacity;
+    current.requested -= buffer->size;
+    current.waiting += buffer->capacity;
+    buffer->size = 0;
+    releasing.push_back(*buffer);
+    *buffer = GpuBuffer();
+}
+
+void GpuBufferPool::end_frame()
+{
+    frame++;
+
+    if (!releasing.empty()) {
+        retired.emplace_back();
+        retired.back().fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        retired.back().buffers.swap(releasing);
+    }
+
+    while (!retired.empty()) {
+        Retired &batch = retired.front();
+        GLenum status = glClientWaitSync((GLsync)batch.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync((GLsync)batch.fence);
+        for (GpuBuffer &buffer : batch.buffers) {
+            unsigned bucket;
+            BucketSize(buffer.capacity, &bucket);
+            free_lists[(size_t)buffer.kind][bucket].push_back({ buffer, frame });
+            current.waiting -= buffer.capacity;
+            current.free += buffer.capacity;
+        }
+        retired.erase(retired.begin());
+    }
+
+    // Released in order, so the oldest of each bucket come first
+    for (auto &kind_free : free_lists) {
+        for (std::vector<FreeBuffer> &bucket_free : kind_free) {
+            size_t idle = 0;
+            while (idle < bucket_free.size() && frame - bucket_free[idle].released > IDLE_FRAMES)
+                idle++;
+            for (size_t i = 0; i < idle; i++) {
+                current.free -= bucket_free[i].buffer.capacity;
+                destroy(&bucket_free[i].buffer);
+            }
+            bucket_free.erase(bucket_free.begin(), bucket_free.begin() + idle);
+        }
+    }
+
+    TRACE_COUNTER("GPU Buffer MB", current.allocated / 1048576.);
+    std::lock_guard<std::mutex> guard(stats_lock);
+    published = current;
+}
+
+void GpuBufferPool::destroy(GpuBuffer *buffer)
+{
+    glDeleteBuffers(1, &buffer->id);
+    current.buffers--;
+    current.allocated -= buffer->capacity;
+    current.deleted++;
+    *buffer = GpuBuffer();
+}
+
+void GpuBufferPool::clear()
+{
+    for (auto &kind_free : free_lists) {
+        for (std::vector<FreeBuffer> &bucket_free : kind_free) {
+            for (FreeBuffer &entry : bucket_free)
+                destroy(&entry.buffer);
+            bucket_free.clear();
+        }
+    }
+    for (Retired &batch : retired) {
+        glDeleteSync((GLsync)batch.fence);
+        for (GpuBuffer &buffer : batch.buffers)
+            destroy(&buffer);
+    }
+    retired.clear();
+    for (GpuBuffer &buffer : releasing)
+        destroy(&buffer);
+    releasing.clear();
+
+    current.free = current.waiting = 0;
+    std::lock_guard<std::mutex> guard(stats_lock);
+    published = current;
+}
+
+GpuBufferPool::Stats GpuBufferPool::stats() const
+{
+    std::lock_guard<std::mutex> guard(stats_lock);
+    return published;
+}
+
+void GpuBufferPool::draw_ui() const
+{
+    if (!ImGui::CollapsingHeader("GPU Buffers"))
+        return;
+
+    Stats stats = this->stats();
+    float mb = 1.f / 1048576.f;
+    ImGui::Text("%zu buffers, %.1f MB (peak %.1f MB)", stats.buffers, stats.allocated * mb, stats.high_water * mb);
+    ImGui::Text("In use: %.1f MB, %.1f MB of it asked for", stats.in_use * mb, stats.requested * mb);
+    ImGui::Text("Free: %.1f MB, waiting on the GPU: %.1f MB", stats.free * mb, stats.waiting * mb);
+    // Lost to rounding up to buckets, and to storage nobody is using
+    float rounding = stats.in_use ? 1.f - (float)stats.requested / stats.in_use : 0.f;
+    float idle = stats.allocated ? (float)(stats.free + stats.waiting) / stats.allocated : 0.f;
+    ImGui::Text("Fragmentation: %.0f%% rounding, %.0f%% idle", rounding * 100.f, idle * 100.f);
+    ImGui::Text("Created %lu, reused %lu, orphaned %lu, deleted %lu",
+        stats.created, stats.reused, stats.orphaned, stats.deleted);
+
+    ImGui::Spacing();
+}
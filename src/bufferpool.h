@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+enum class BufferKind {
+    Vertex,
+    Index,
+    KINDS,
+};
+
+struct GpuBuffer {
+    unsigned id = 0;
+    BufferKind kind = BufferKind::Vertex;
+    // Bytes of storage, and how many of them were asked for
+    size_t capacity = 0, size = 0;
+};
+
+// Hands out GL buffers in size buckets, four to every power of two, so
+// meshes of about the same size reuse each other's storage. A released
+// buffer is only handed out again once a fence placed at the end of its
+// frame has signalled, so writing into it never waits on the GPU; when a
+// bucket has nothing free yet, a buffer still waiting is orphaned instead.
+// Free buffers nobody asked for in a while are deleted.
+//
+// Used on the thread drawing snapshots; stats() and draw_ui() may be
+// called from any thread.
+struct GpuBufferPool {
+    static constexpr size_t MIN_BUCKET = 64 << 10;
+    static constexpr unsigned BUCKETS = 64;
+    // Frames a free buffer is kept around unused
+    static constexpr unsigned long IDLE_FRAMES = 300;
+
+    struct Stats {
+        size_t buffers = 0;
+        // Bytes of storage, and the most there ever was
+        size_t allocated = 0, high_water = 0;
+        // Storage in use, and how much of it was asked for
+        size_t in_use = 0, requested = 0;
+        size_t free = 0, waiting = 0;
+        unsigned long created = 0, reused = 0, orphaned = 0, deleted = 0;
+    };
+
+    GpuBufferPool()
+    {
+    }
+    GpuBufferPool(const GpuBufferPool &) = delete;
+    GpuBufferPool &operator=(const GpuBufferPool &) = delete;
+    ~GpuBufferPool();
+
+    GpuBuffer acquire(BufferKind kind, size_t bytes);
+    // Commands already queued may still read it
+    void release(GpuBuffer *buffer);
+    // Fences the frame's releases and frees the buffers of earlier frames
+    // whose fences have signalled
+    void end_frame();
+    // Deletes everything, on the thread that made it
+    void clear();
+
+    Stats stats() const;
+    void draw_ui() const;
+
+private:
+    struct FreeBuffer {
+        GpuBuffer buffer;
+        unsigned long released;
+    };
+    struct Retired {
+        void *fence;
+        std::vector<GpuBuffer> buffers;
+    };
+
+    // By kind, then bucket
+    std::vector<FreeBuffer> free_lists[(size_t)BufferKind::KINDS][BUCKETS];
+    std::vector<GpuBuffer> releasing;
+    // Oldest first, the fences signal in order
+    std::vector<Retired> retired;
+    unsigned long frame = 0;
+
+    Stats current;
+    mutable std::mutex stats_lock;
+    Stats published;
+
+    void destroy(GpuBuffer *buffer);
+};
@@ -4,10 +4,11 @@
 #include <imgui_stdlib.h>
 
 #include "game.h"
+#include "replay.h"
 
 void CameraEditor::update(GameState *ctx, Object *obj, float dt)
 {
-    (void)ctx; (void)dt;
+    (void)dt;
 
     Camera &camera = obj->component<Camera>().value();
     bool cam_diff = false;
@@ -32,9 +33,20 @@ void CameraEditor::update(GameState *ctx, Object *obj, float dt)
         ImGui::Spacing();
     }
 
+    if (SessionLog *session = ctx->session) {
+        // The aspect ratio follows the window, not the recording
+        float aspect = camera_params.aspect;
+        bool params_diff = session->sync_value("Camera Params", &camera_params, cam_diff);
+        camera_params.aspect = aspect;
+        bool pos_diff = session->sync_value("Camera Position", &camera.pos, cam_diff);
+        bool look_diff = session->sync_value("Camera Direction", &camera.look, cam_diff);
+        cam_diff = params_diff || pos_diff || look_diff;
+    }
+
     if (cam_diff) {
         printf("Refreshing camera...\n");
         camera.set_params(camera_params);
+        camera.xform_dirty = true;
     }
 }
 
@@ -66,14 +78,31 @@ void Camera::set_xform(glm::vec3 pos, glm::vec3 look)
 
 void Camera::update(GameState *ctx, Object *obj, float dt)
 {
-    CameraEditor &editor = obj->component<CameraEditor>().value();
+    (void)obj; (void)dt;
+
+    // Moving is done in compute(), which can't touch ctx
+    const Controller &controller = ctx->controller;
+    if (controller.moving() || controller.movement != glm::zero<glm::vec3>() || controller.look != glm::zero<glm::vec2>())
+        ctx->request_redraw();
+}
+
+void Camera::compute(const GameState *ctx, Object *obj, float dt)
+{
+    (void)dt;
+    const CameraEditor &editor = obj->component<CameraEditor>().value();
+    const Controller &controller = ctx->controller;
+
+    // The controller has already weighted each input by how long it was
+    // held this frame, so dt doesn't come into it
+    if (!controller.moving())
+        return;
 
     float mv_speed = editor.camera_params.move_speed;
     glm::vec2 look_speed = editor.camera_params.look_speed;
 
-    this->look += dt * look_speed * ctx->controller.look;
-    glm::vec3 look_movement = glm::rotate(ctx->controller.movement, -this->look.x, glm::vec3(0, 1, 0));
-    this->pos += dt * mv_speed * look_movement;
+    this->look += look_speed * controller.look_held;
+    glm::vec3 look_movement = glm::rotate(controller.movement_held, -this->look.x, glm::vec3(0, 1, 0));
+    this->pos += mv_speed * look_movement;
     if (this->look.y > M_PI/2)
         this->look.y = M_PI/2;
     if (this->look.y < -M_PI/2)
@@ -81,3 +110,8 @@ void Camera::update(GameState *ctx, Object *obj, float dt)
     this->xform_dirty = true;
 }
 
+std::optional<ComponentAccess> Camera::compute_access() const
+{
+    return ComponentAccess().read<CameraEditor>();
+}
+
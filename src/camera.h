@@ -39,12 +39,14 @@ struct Camera : Component {
     void set_xform(glm::vec3 pos, glm::vec3 look);
 
     void update(GameState *ctx, Object *obj, float dt);
+    void compute(const GameState *ctx, Object *obj, float dt);
+    std::optional<ComponentAccess> compute_access() const;
 };
 
 
-inline Object CreateCamera()
+inline Object CreateCamera(World *world)
 {
-    Object object;
+    Object object(world);
 
     CameraEditor camera_editor;
     Camera camera(camera_editor.camera_params);
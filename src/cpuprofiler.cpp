@@ -0,0 +1,141 @@
+#include "cpuprofiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <imgui.h>
+
+void CpuProfiler::begin_frame()
+{
+    frame_start = Clock::now();
+    frame_allocs_start = AllocTotalStats();
+}
+
+void CpuProfiler::end_frame()
+{
+    last_ms = std::chrono::duration<float, std::milli>(Clock::now() - frame_start).count();
+    unsigned slot = frames % HISTORY;
+    frame_history[slot] = last_ms;
+    frames++;
+    TRACE_COUNTER("CPU frame (ms)", last_ms);
+    last_allocs = AllocTotalStats() - frame_allocs_start;
+    TRACE_COUNTER("Allocations", last_allocs.count);
+
+    for (Phase &phase : phases) {
+        phase.last_ms = phase.ms;
+        phase.last_calls = phase.calls;
+        phase.last_allocs = phase.allocs;
+        phase.history[slot] = phase.ms;
+        phase.ms = 0;
+        phase.calls = 0;
+        phase.allocs = {};
+    }
+
+    if (alloc_budget >= 0 && frames > alloc_warmup && last_allocs.count > (unsigned long)alloc_budget)
+        report_allocs();
+
+    unsigned count = std::min(frames, HISTORY);
+    float sorted[HISTORY];
+    std::copy(frame_history, frame_history + count, sorted);
+    auto percentile = [&](float p) {
+        float *nth = sorted + (size_t)(p * (count - 1));
+        std::nth_element(sorted, nth, sorted + count);
+        return *nth;
+    };
+    p50 = percentile(0.50f);
+    p95 = percentile(0.95f);
+    p99 = percentile(0.99f);
+
+    last_slow = count > 1 && last_ms > p50 * slow_factor;
+    if (last_slow)
+        slow_frames++;
+}
+
+unsigned CpuProfiler::enter(const char *name)
+{
+    unsigned index = 0;
+    for (; index < phases.size(); index++) {
+        if (!strcmp(phases[index].name, name))
+            break;
+    }
+    if (index == phases.size()) {
+        Phase phase;
+        phase.name = name;
+        phase.depth = depth;
+        phases.push_back(phase);
+    }
+
+    depth++;
+    return index;
+}
+
+void CpuProfiler::leave(unsigned phase, Clock::time_point start, AllocStats allocs_start)
+{
+    depth--;
+    Phase &p = phases[phase];
+    p.ms += std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+    p.calls++;
+    AllocStats allocs = AllocThreadStats() - allocs_start;
+    p.allocs.count += allocs.count;
+    p.allocs.bytes += allocs.bytes;
+}
+
+void CpuProfiler::report_allocs()
+{
+    alloc_violations++;
+    printf("Frame %u made %llu allocations (%llu bytes), the budget is %ld\n", frames - 1,
+        (unsigned long long)last_allocs.count, (unsigned long long)last_allocs.bytes, alloc_budget);
+    for (const Phase &phase : phases) {
+        if (phase.last_allocs.count == 0)
+            continue;
+        printf("  %*s%s: %llu (%llu bytes)\n", (int)phase.depth * 2, "", phase.name,
+            (unsigned long long)phase.last_allocs.count, (unsigned long long)phase.last_allocs.bytes);
+    }
+}
+
+void CpuProfiler::draw_ui()
+{
+    ImGui::Checkbox("Show Frame Profiler", &show_overlay);
+    if (!show_overlay)
+        return;
+
+    ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize |
+        ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav;
+    ImVec2 display = ImGui::GetIO().DisplaySize;
+    ImGui::SetNextWindowPos(ImVec2(display.x - 10, 10), ImGuiCond_Always, ImVec2(1, 0));
+    ImGui::SetNextWindowBgAlpha(0.35f);
+
+    if (ImGui::Begin("Frame Profiler", &show_overlay, flags)) {
+        ImGui::Text("Frame %.2f ms", last_ms);
+        ImGui::Text("p50 %.2f  p95 %.2f  p99 %.2f ms", p50, p95, p99);
+        if (last_slow)
+            ImGui::TextColored(ImVec4(1, 0.3f, 0.3f, 1), "Slow frame! (%u so far)", slow_frames);
+        else
+            ImGui::Text("Slow frames: %u", slow_frames);
+        if (AllocTrackingEnabled())
+            ImGui::Text("Allocations: %llu (%llu bytes)",
+                (unsigned long long)last_allocs.count, (unsigned long long)last_allocs.bytes);
+
+        unsigned count = std::min(frames, HISTORY);
+        unsigned offset = frames % HISTORY;
+        ImGui::PlotHistogram("##frames", frame_history, count, offset,
+            nullptr, 0.f, p99 * 1.25f, ImVec2(300, 60));
+
+        ImGui::Separator();
+        for (unsigned i = 0; i < phases.size(); i++) {
+            const Phase &phase = phases[i];
+            ImGui::PushID(i);
+            ImGui::Text("%*s%s", (int)phase.depth * 2, "", phase.name);
+            ImGui::SameLine(180);
+            ImGui::Text("%6.3f ms x%u", phase.last_ms, phase.last_calls);
+            ImGui::SameLine(300);
+            ImGui::Text("%4llu allocs", (unsigned long long)phase.last_allocs.count);
+            ImGui::SameLine(390);
+            ImGui::PlotLines("##history", phase.history, count, offset,
+                nullptr, 0.f, p99, ImVec2(100, 16));
+            ImGui::PopID();
+        }
+    }
+    ImGui::End();
+}
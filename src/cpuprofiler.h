@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include "alloctrack.h"
+#include "trace.h"
+
+// CPU time spent in each phase of the main loop and in every component's
+// update, kept over a rolling window of frames. Scopes also show up in
+// recorded traces. Heap allocations are counted per frame across all
+// threads, and per phase for the thread that entered it.
+struct CpuProfiler {
+    static constexpr unsigned HISTORY = 240;
+    typedef std::chrono::steady_clock Clock;
+
+    struct Phase {
+        const char *name;
+        unsigned depth;
+        // Accumulated during the current frame
+        float ms = 0;
+        unsigned calls = 0;
+        AllocStats allocs;
+        // Last finished frame
+        float last_ms = 0;
+        unsigned last_calls = 0;
+        AllocStats last_allocs;
+        float history[HISTORY] = {};
+    };
+
+    bool show_overlay = false;
+    // Frames slower than this many times the median are flagged
+    float slow_factor = 1.5f;
+
+    std::vector<Phase> phases;
+    float frame_history[HISTORY] = {};
+    unsigned frames = 0;
+    float last_ms = 0;
+    float p50 = 0, p95 = 0, p99 = 0;
+    unsigned slow_frames = 0;
+    bool last_slow = false;
+
+    AllocStats last_allocs;
+    // Frames after the first `alloc_warmup` that allocate more than
+    // `alloc_budget` times are reported, negative turns the check off
+    long alloc_budget = -1;
+    unsigned alloc_warmup = 60;
+    unsigned alloc_violations = 0;
+
+    void begin_frame();
+    void end_frame();
+
+    // Used through PROFILE_SCOPE
+    unsigned enter(const char *name);
+    void leave(unsigned phase, Clock::time_point start, AllocStats allocs_start);
+
+    void draw_ui();
+
+private:
+    Clock::time_point frame_start;
+    AllocStats frame_allocs_start;
+    unsigned depth = 0;
+
+    void report_allocs();
+};
+
+struct ProfileScope {
+    CpuProfiler *profiler;
+    const char *name;
+    unsigned phase;
+    CpuProfiler::Clock::time_point start;
+    AllocStats allocs_start;
+
+    ProfileScope(CpuProfiler *profiler, const char *name):
+        profiler(profiler), name(name), phase(profiler->enter(name)), start(CpuProfiler::Clock::now()),
+        allocs_start(AllocThreadStats())
+    {
+    }
+
+    ~ProfileScope()
+    {
+        profiler->leave(phase, start, allocs_start);
+        if (TraceEnabled())
+            TraceComplete(name, start, CpuProfiler::Clock::now());
+    }
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+// Times the rest of the enclosing block as the phase `name`
+#define PROFILE_SCOPE(profiler, name) \
+    ProfileScope PROFILE_CONCAT(__profile_scope__, __LINE__) (profiler, name)
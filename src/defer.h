@@ -1,12 +1,17 @@
-#include <functional>
+#pragma once
 
+// Holds the lambda itself rather than a std::function, so deferring never
+// allocates
+template <typename F>
 class Deferrer {
-    std::function<void()> fn;
+    F fn;
 public:
-    Deferrer(std::function<void()> fn): fn(fn)
+    Deferrer(F fn): fn(fn)
     {
     }
 
+    Deferrer(const Deferrer &other) = delete;
+
     ~Deferrer()
     {
         this->fn();
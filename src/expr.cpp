@@ -0,0 +1,317 @@
+#include "expr.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+struct ExprFn {
+    const char *name;
+    size_t arity;
+    float (*fn)(const float *args);
+};
+
+static float glsl_mod(float x, float y)
+{
+    return x - y * floorf(x / y);
+}
+
+static float glsl_smoothstep(float e0, float e1, float x)
+{
+    float s = (x - e0) / (e1 - e0);
+    s = s < 0 ? 0 : (s > 1 ? 1 : s);
+    return s * s * (3 - 2 * s);
+}
+
+static const ExprFn expr_fns[] = {
+    { "sin",         1, [](const float *a) { return sinf(a[0]); } },
+    { "cos",         1, [](const float *a) { return cosf(a[0]); } },
+    { "tan",         1, [](const float *a) { return tanf(a[0]); } },
+    { "asin",        1, [](const float *a) { return asinf(a[0]); } },
+    { "acos",        1, [](const float *a) { return acosf(a[0]); } },
+    { "atan",        1, [](const float *a) { return atanf(a[0]); } },
+    { "atan",        2, [](const float *a) { return atan2f(a[0], a[1]); } },
+    { "sinh",        1, [](const float *a) { return sinhf(a[0]); } },
+    { "cosh",        1, [](const float *a) { return coshf(a[0]); } },
+    { "tanh",        1, [](const float *a) { return tanhf(a[0]); } },
+    { "asinh",       1, [](const float *a) { return asinhf(a[0]); } },
+    { "acosh",       1, [](const float *a) { return acoshf(a[0]); } },
+    { "atanh",       1, [](const float *a) { return atanhf(a[0]); } },
+    { "exp",         1, [](const float *a) { return expf(a[0]); } },
+    { "exp2",        1, [](const float *a) { return exp2f(a[0]); } },
+    { "log",         1, [](const float *a) { return logf(a[0]); } },
+    { "log2",        1, [](const float *a) { return log2f(a[0]); } },
+    { "sqrt",        1, [](const float *a) { return sqrtf(a[0]); } },
+    { "inversesqrt", 1, [](const float *a) { return 1 / sqrtf(a[0]); } },
+    { "pow",         2, [](const float *a) { return powf(a[0], a[1]); } },
+    { "abs",         1, [](const float *a) { return fabsf(a[0]); } },
+    { "sign",        1, [](const float *a) { return (float)((a[0] > 0) - (a[0] < 0)); } },
+    { "floor",       1, [](const float *a) { return floorf(a[0]); } },
+    { "ceil",        1, [](const float *a) { return ceilf(a[0]); } },
+    { "trunc",       1, [](const float *a) { return truncf(a[0]); } },
+    { "round",       1, [](const float *a) { return roundf(a[0]); } },
+    { "fract",       1, [](const float *a) { return a[0] - floorf(a[0]); } },
+    { "radians",     1, [](const float *a) { return a[0] * (float)M_PI / 180; } },
+    { "degrees",     1, [](const float *a) { return a[0] * 180 / (float)M_PI; } },
+    { "mod",         2, [](const float *a) { return glsl_mod(a[0], a[1]); } },
+    { "min",         2, [](const float *a) { return fminf(a[0], a[1]); } },
+    { "max",         2, [](const float *a) { return fmaxf(a[0], a[1]); } },
+    { "step",        2, [](const float *a) { return a[1] < a[0] ? 0.f : 1.f; } },
+    { "clamp",       3, [](const float *a) { return fminf(fmaxf(a[0], a[1]), a[2]); } },
+    { "mix",         3, [](const float *a) { return a[0] + (a[1] - a[0]) * a[2]; } },
+    { "smoothstep",  3, [](const float *a) { return glsl_smoothstep(a[0], a[1], a[2]); } },
+};
+
+
+
+ExprRef Expr::make_num(float num, std::string text)
+{
+    auto e = std::make_shared<Expr>();
+    e->kind = Kind::Num;
+    e->num = num;
+    e->text = std::move(text);
+    return e;
+}
+
+ExprRef Expr::make_var(const std::string &name)
+{
+    auto e = std::make_shared<Expr>();
+    e->kind = Kind::Var;
+    e->text = name;
+    e->deps = name == "u" ? DEP_U : name == "v" ? DEP_V : DEP_T;
+    return e;
+}
+
+ExprRef Expr::make_neg(ExprRef arg)
+{
+    auto e = std::make_shared<Expr>();
+    e->kind = Kind::Neg;
+    e->deps = arg->deps;
+    e->has_call = arg->has_call;
+    e->args = { std::move(arg) };
+    return e;
+}
+
+ExprRef Expr::make_binary(Kind kind, ExprRef lhs, ExprRef rhs)
+{
+    auto e = std::make_shared<Expr>();
+    e->kind = kind;
+    e->deps = lhs->deps | rhs->deps;
+    e->has_call = lhs->has_call || rhs->has_call;
+    e->args = { std::move(lhs), std::move(rhs) };
+    return e;
+}
+
+std::optional<ExprRef> Expr::make_call(const std::string &name, std::vector<ExprRef> args)
+{
+    for (const ExprFn &fn : expr_fns) {
+        if (name != fn.name || args.size() != fn.arity)
+            continue;
+
+        auto e = std::make_shared<Expr>();
+        e->kind = Kind::Call;
+        e->text = name;
+        e->fn = fn.fn;
+        e->has_call = true;
+        for (auto &arg : args)
+            e->deps |= arg->deps;
+        e->args = std::move(args);
+        return e;
+    }
+    return {};
+}
+
+
+
+struct ExprParser {
+    const char *pos;
+
+    void skip_space()
+    {
+        while (isspace(*pos))
+            pos++;
+    }
+
+    bool accept(char c)
+    {
+        skip_space();
+        if (*pos != c)
+            return false;
+        pos++;
+        return true;
+    }
+
+    std::optional<ExprRef> parse_sum()
+    {
+        auto lhs = parse_product();
+        while (lhs) {
+            Expr::Kind kind;
+            if (accept('+'))
+                kind = Expr::Kind::Add;
+            else if (accept('-'))
+                kind = Expr::Kind::Sub;
+            else
+                break;
+
+            auto rhs = parse_product();
+            if (!rhs)
+                return {};
+            lhs = Expr::make_binary(kind, *lhs, *rhs);
+        }
+        return lhs;
+    }
+
+    std::optional<ExprRef> parse_product()
+    {
+        auto lhs = parse_unary();
+        while (lhs) {
+            Expr::Kind kind;
+            if (accept('*'))
+                kind = Expr::Kind::Mul;
+            else if (accept('/'))
+                kind = Expr::Kind::Div;
+            else
+                break;
+
+            auto rhs = parse_unary();
+            if (!rhs)
+                return {};
+            lhs = Expr::make_binary(kind, *lhs, *rhs);
+        }
+        return lhs;
+    }
+
+    std::optional<ExprRef> parse_unary()
+    {
+        if (accept('+'))
+            return parse_unary();
+        if (accept('-')) {
+            auto arg = parse_unary();
+            if (!arg)
+                return {};
+            return Expr::make_neg(*arg);
+        }
+        return parse_primary();
+    }
+
+    std::optional<ExprRef> parse_primary()
+    {
+        skip_space();
+
+        if (accept('(')) {
+            auto inner = parse_sum();
+            if (!inner || !accept(')'))
+                return {};
+            return inner;
+        }
+
+        if (isdigit(*pos) || *pos == '.') {
+            const char *start = pos;
+            char *end;
+            float num = strtof(start, &end);
+            if (end == start)
+                return {};
+            pos = end;
+            if (*pos == 'f' || *pos == 'F')
+                pos++;
+            return Expr::make_num(num, std::string(start, pos));
+        }
+
+        if (isalpha(*pos) || *pos == '_') {
+            const char *start = pos;
+            while (isalnum(*pos) || *pos == '_')
+                pos++;
+            std::string name(start, pos);
+
+            if (!accept('(')) {
+                if (name != "u" && name != "v" && name != "t")
+                    return {};
+                return Expr::make_var(name);
+            }
+
+            std::vector<ExprRef> args;
+            if (!accept(')')) {
+                do {
+                    auto arg = parse_sum();
+                    if (!arg)
+                        return {};
+                    args.push_back(*arg);
+                } while (accept(','));
+
+                if (!accept(')'))
+                    return {};
+            }
+            return Expr::make_call(name, std::move(args));
+        }
+
+        return {};
+    }
+};
+
+std::optional<ExprRef> Expr::parse(const std::string &src)
+{
+    ExprParser parser { src.c_str() };
+    auto expr = parser.parse_sum();
+    parser.skip_space();
+    if (!expr || *parser.pos != '\0')
+        return {};
+    return expr;
+}
+
+
+
+float Expr::eval(float u, float v, float t) const
+{
+    switch (kind) {
+    case Kind::Num:
+        return num;
+    case Kind::Var:
+        return deps == DEP_U ? u : deps == DEP_V ? v : t;
+    case Kind::Neg:
+        return -args[0]->eval(u, v, t);
+    case Kind::Add:
+        return args[0]->eval(u, v, t) + args[1]->eval(u, v, t);
+    case Kind::Sub:
+        return args[0]->eval(u, v, t) - args[1]->eval(u, v, t);
+    case Kind::Mul:
+        return args[0]->eval(u, v, t) * args[1]->eval(u, v, t);
+    case Kind::Div:
+        return args[0]->eval(u, v, t) / args[1]->eval(u, v, t);
+    case Kind::Call: {
+        float vals[3];
+        for (size_t i = 0; i < args.size(); i++)
+            vals[i] = args[i]->eval(u, v, t);
+        return fn(vals);
+    }
+    }
+    return 0;
+}
+
+std::string Expr::glsl() const
+{
+    switch (kind) {
+    case Kind::Num:
+    case Kind::Var:
+        return text;
+    case Kind::Neg:
+        return "(-" + args[0]->glsl() + ")";
+    case Kind::Add:
+        return "(" + args[0]->glsl() + " + " + args[1]->glsl() + ")";
+    case Kind::Sub:
+        return "(" + args[0]->glsl() + " - " + args[1]->glsl() + ")";
+    case Kind::Mul:
+        return "(" + args[0]->glsl() + " * " + args[1]->glsl() + ")";
+    case Kind::Div:
+        return "(" + args[0]->glsl() + " / " + args[1]->glsl() + ")";
+    case Kind::Call: {
+        std::string out = text + "(";
+        for (size_t i = 0; i < args.size(); i++) {
+            if (i)
+                out += ", ";
+            out += args[i]->glsl();
+        }
+        return out + ")";
+    }
+    }
+    return "";
+}
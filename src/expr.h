@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Which of the parametric variables an expression reads
+enum ExprDep : unsigned {
+    DEP_NONE = 0,
+    DEP_U = 1 << 0,
+    DEP_V = 1 << 1,
+    DEP_T = 1 << 2,
+};
+
+struct Expr;
+typedef std::shared_ptr<const Expr> ExprRef;
+
+// Parsed form of the GLSL subset accepted in the equation editor: float
+// literals, the variables u/v/t, arithmetic, and the scalar builtins.
+struct Expr {
+    enum class Kind {
+        Num,
+        Var,
+        Neg,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Call,
+    };
+
+    Kind kind;
+    float num = 0;
+    // Literal spelling for Num, variable name for Var, function name for Call
+    std::string text;
+    std::vector<ExprRef> args;
+    float (*fn)(const float *args) = nullptr;
+
+    unsigned deps = DEP_NONE;
+    bool has_call = false;
+
+    // Returns nothing for anything outside the supported subset
+    static std::optional<ExprRef> parse(const std::string &src);
+
+    static ExprRef make_num(float num, std::string text);
+    static ExprRef make_var(const std::string &name);
+    static ExprRef make_neg(ExprRef arg);
+    static ExprRef make_binary(Kind kind, ExprRef lhs, ExprRef rhs);
+    static std::optional<ExprRef> make_call(const std::string &name, std::vector<ExprRef> args);
+
+    float eval(float u, float v, float t) const;
+    std::string glsl() const;
+};
@@ -0,0 +1,262 @@
+#include "frame.h"
+
+#include <algorithm>
+#include <chrono>
+#include <optional>
+
+#include <SDL.h>
+
+#include <imgui.h>
+
+#include "arena.h"
+#include "axes.h"
+#include "camera.h"
+#include "game.h"
+#include "renderer.h"
+#include "replay.h"
+#include "resscale.h"
+#include "scheduler.h"
+#include "shader.h"
+#include "softraster.h"
+#include "surface.h"
+#include "threadpool.h"
+#include "trace.h"
+
+void SetupScene(GameState *ctx, int width, int height)
+{
+    ctx->add_main_camera(CreateCamera(&ctx->world));
+    ctx->add_object(CreateSurface(&ctx->world));
+    ctx->add_object(CreateAxes(&ctx->world));
+
+    Object &cam_obj = ctx->objects.at(ctx->main_camera.value());
+    cam_obj.add_component(ResolutionScaler());
+    CameraParams &cparams = cam_obj.component<CameraEditor>()->get().camera_params;
+    cparams.aspect = (float)width / (float)height;
+    cam_obj.component<Camera>()->get().set_params(cparams);
+
+    ctx->view_w = width;
+    ctx->view_h = height;
+
+    ctx->running = true;
+}
+
+// Copies everything the GL backend draws out of the scene, without the UI
+static void BuildScene(GameState *ctx, FrameSnapshot *snap)
+{
+    Object &cam_obj = ctx->objects.at(ctx->main_camera.value());
+    Camera &cam = cam_obj.component<Camera>().value();
+    ResolutionScaler &scaler = cam_obj.component<ResolutionScaler>().value();
+
+    snap->time = ctx->time;
+    snap->view_w = ctx->view_w;
+    snap->view_h = ctx->view_h;
+    scaler.scene_size(ctx->view_w, ctx->view_h, &snap->scene_w, &snap->scene_h);
+    snap->view = cam.xform();
+    snap->projection = cam.projection;
+
+    snap->draw_count = 0;
+    bool uploading = false;
+    ForEachComponent<Renderer>(&ctx->world, [&](Object &object, Renderer &renderer) {
+        if (snap->draws.size() == snap->draw_count)
+            snap->draws.emplace_back();
+        DrawItem *item = &snap->draws[snap->draw_count];
+        if (renderer.snapshot(ctx, &object, item)) {
+            uploading |= item->upload_mesh;
+            snap->draw_count++;
+        }
+    });
+
+    // Uploads only move along while frames are drawn. The backlog is seen
+    // a few frames late, as many as can be in flight.
+    snap->upload_budget = ctx->upload_budget;
+    if (uploading || ctx->render_queue.upload_backlog.load())
+        ctx->request_redraw(RenderQueue::SLOTS + 1);
+
+    snap->has_ui = false;
+    TakeReleasedKeys(&snap->released_keys);
+    TakeReleasedPrograms(&snap->released_programs);
+    snap->inputs = ctx->latency.frame_inputs();
+}
+
+void DrawFrame(GameState *ctx)
+{
+    if (render_backend == RenderBackend::GL) {
+        FrameSnapshot *snap = ctx->render_queue.acquire();
+        BuildScene(ctx, snap);
+        ctx->render_queue.submit(snap);
+        return;
+    }
+
+    Object &cam_obj = ctx->objects.at(ctx->main_camera.value());
+    Camera &cam = cam_obj.component<Camera>().value();
+    ResolutionScaler &scaler = cam_obj.component<ResolutionScaler>().value();
+
+    int scene_w, scene_h;
+    scaler.scene_size(ctx->view_w, ctx->view_h, &scene_w, &scene_h);
+    ctx->soft_raster->begin_frame(scene_w, scene_h);
+
+    ForEachComponent<Renderer>(&ctx->world, [&](Object &object, Renderer &renderer) {
+        renderer.draw(ctx, &object, &cam);
+    });
+
+    ctx->soft_raster->end_frame();
+}
+
+static void ApplyInput(Controller *controller, const Input &input)
+{
+    glm::vec3 &movement = controller->movement;
+    glm::vec2 &look = controller->look;
+
+    switch (input.type) {
+    case InputType::Reset:
+        movement *= 0;
+        look *= 0;
+        break;
+    case InputType::Key: {
+        int digital_press_vector = input.digital.press - !input.digital.press;
+
+        switch (input.digital.source) {
+        case SDL_SCANCODE_W:            movement.z -= digital_press_vector; break;
+        case SDL_SCANCODE_S:            movement.z += digital_press_vector; break;
+        case SDL_SCANCODE_A:            movement.x -= digital_press_vector; break;
+        case SDL_SCANCODE_D:            movement.x += digital_press_vector; break;
+        case SDL_SCANCODE_SPACE:        movement.y += digital_press_vector; break;
+        case SDL_SCANCODE_LSHIFT:       movement.y -= digital_press_vector; break;
+        case SDL_SCANCODE_UP:           look.y += digital_press_vector; break;
+        case SDL_SCANCODE_DOWN:         look.y -= digital_press_vector; break;
+        case SDL_SCANCODE_LEFT:         look.x -= digital_press_vector; break;
+        case SDL_SCANCODE_RIGHT:        look.x += digital_press_vector; break;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void Update(GameState *ctx, float dt)
+{
+    FrameVector<Input> inputs;
+    std::optional<Input> input;
+    while ((input = ctx->input_buf.pop()))
+        inputs.push_back(*input);
+
+    if (ctx->session)
+        ctx->session->sync_inputs(&inputs);
+    ctx->latency.consume(inputs.data(), inputs.size());
+
+    // Every input takes effect at the moment it happened, so held keys move
+    // the camera for exactly as long as they were held. The frame covers
+    // everything up to ctx->time, later inputs count from its end.
+    Controller &controller = ctx->controller;
+    if (controller.time > ctx->time || controller.time < ctx->time - dt)
+        controller.time = ctx->time - dt;
+    controller.movement_held *= 0;
+    controller.look_held *= 0;
+
+    if (ctx->input_buf.dropped.exchange(false)) {
+        Input reset;
+        reset.type = InputType::Reset;
+        ApplyInput(&controller, reset);
+    }
+    for (const Input &input : inputs) {
+        controller.advance(std::min(input.time, ctx->time));
+        ApplyInput(&controller, input);
+    }
+    controller.advance(ctx->time);
+
+    for (Object &object : ctx->objects) {
+        if (!object.deleted)
+            object.update(ctx, dt);
+    }
+
+    {
+        PROFILE_SCOPE(&ctx->cpu_profiler, "Compute");
+        RunComputePasses(ctx, &ThreadPool::shared(), dt);
+    }
+    {
+        PROFILE_SCOPE(&ctx->cpu_profiler, "Jobs");
+        ctx->jobs.run_main();
+    }
+    // Keep drawing until their results are in
+    if (ctx->jobs.busy())
+        ctx->request_redraw();
+    ctx->latency.mark(LatencyTracker::Simulated);
+}
+
+void RenderFrame(GameState *ctx)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (ctx->session)
+        ctx->session->begin_frame(ctx);
+    ctx->latency.begin_frame(ctx->time);
+    if (ctx->latency.synthetic_period) {
+        ctx->latency.synthesize(&ctx->input_buf, ctx->time);
+        ctx->request_redraw();
+    }
+    ImGui::NewFrame();
+
+    ImGui::Begin("Configuration");
+    {
+        PROFILE_SCOPE(&ctx->cpu_profiler, "Update");
+        Update(ctx, ctx->dt);
+    }
+
+    if (ImGui::IsAnyItemActive()) {
+        ctx->request_redraw();
+    }
+
+    bool add_surface = ImGui::Button("Add Surface");
+    if (ctx->session)
+        add_surface = ctx->session->sync_value("Add Surface", &add_surface, add_surface);
+    if (add_surface) {
+        ctx->add_object(CreateSurface(&ctx->world));
+    }
+    ctx->gpu_profiler.draw_ui();
+    ctx->latency.draw_ui();
+    ctx->jobs.draw_ui();
+    ctx->render_queue.buffer_pool().draw_ui();
+    ctx->cpu_profiler.draw_ui();
+    TraceDrawUI();
+    ImGui::End();
+
+    // The GL backend draws from a snapshot, on the render thread if there
+    // is one. Waiting for a free slot means it's behind by whole frames.
+    FrameSnapshot *snap = nullptr;
+    if (render_backend == RenderBackend::GL) {
+        PROFILE_SCOPE(&ctx->cpu_profiler, "Render Wait");
+        snap = ctx->render_queue.acquire();
+    }
+
+    {
+        PROFILE_SCOPE(&ctx->cpu_profiler, "Draw");
+        if (snap)
+            BuildScene(ctx, snap);
+        else
+            DrawFrame(ctx);
+    }
+
+    ctx->remove_deleted_objects();
+
+    {
+        PROFILE_SCOPE(&ctx->cpu_profiler, "ImGui Render");
+        ImGui::Render();
+        if (snap) {
+            snap->ui.copy(ImGui::GetDrawData());
+            snap->has_ui = true;
+        }
+    }
+
+    if (snap) {
+        PROFILE_SCOPE(&ctx->cpu_profiler, "Submit");
+        ctx->render_queue.submit(snap);
+    } else {
+        ctx->latency.mark(LatencyTracker::Submitted);
+    }
+    if (ctx->session)
+        ctx->session->end_frame(ctx);
+
+    auto end = std::chrono::steady_clock::now();
+    float frame_ms = std::chrono::duration<float, std::milli>(end - start).count();
+    ctx->cpu_frame_ms = std::max(frame_ms, ctx->render_queue.render_ms.load());
+}
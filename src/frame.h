@@ -0,0 +1,11 @@
+#pragma once
+
+struct GameState;
+
+// Frame steps shared by the windowed and headless loops and the benchmarks
+
+void SetupScene(GameState *ctx, int width, int height);
+void Update(GameState *ctx, float dt);
+void DrawFrame(GameState *ctx);
+// Everything between the platform's new-frame calls and presentation
+void RenderFrame(GameState *ctx);
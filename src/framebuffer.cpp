@@ -0,0 +1,85 @@
+#include "framebuffer.h"
+
+#include <cstdio>
+
+#include <GL/glew.h>
+
+Framebuffer::Framebuffer(int width, int height):
+    width(width), height(height)
+{
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &color_rb);
+    glGenRenderbuffers(1, &depth_rb);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, color_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_rb);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Framebuffer %dx%d is incomplete!\n", width, height);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+Framebuffer::~Framebuffer()
+{
+    if (!valid)
+        return;
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &color_rb);
+    glDeleteRenderbuffers(1, &depth_rb);
+}
+
+void Framebuffer::bind()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+}
+
+void Framebuffer::read_rgba(std::vector<uint8_t> *out)
+{
+    out->resize(width * height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &(*out)[0]);
+}
+
+bool Framebuffer::save_ppm(const std::string &path)
+{
+    std::vector<uint8_t> rgba;
+    read_rgba(&rgba);
+    // GL rows start at the bottom
+    return WritePPM(path, &rgba[0], width, height, true);
+}
+
+
+
+bool WritePPM(const std::string &path, const uint8_t *rgba, int width, int height, bool bottom_up)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        printf("Could not open image at `%s` for writing!\n", path.c_str());
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<uint8_t> row(width * 3);
+    for (int i = 0; i < height; i++) {
+        int y = bottom_up ? height - 1 - i : i;
+        const uint8_t *src = &rgba[y * width * 4];
+        for (int x = 0; x < width; x++) {
+            row[x*3+0] = src[x*4+0];
+            row[x*3+1] = src[x*4+1];
+            row[x*3+2] = src[x*4+2];
+        }
+        fwrite(&row[0], 1, row.size(), file);
+    }
+
+    fclose(file);
+    return true;
+}
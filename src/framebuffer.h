@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "resource.h"
+
+// Offscreen color + depth target
+struct Framebuffer {
+    unsigned fbo, color_rb, depth_rb;
+    int width, height;
+
+    RESOURCE_IMPL(Framebuffer);
+
+    Framebuffer(int width, int height);
+    ~Framebuffer();
+
+    void bind();
+    void read_rgba(std::vector<uint8_t> *out);
+    bool save_ppm(const std::string &path);
+};
+
+// Writes tightly packed RGBA8 pixels as a binary PPM
+bool WritePPM(const std::string &path, const uint8_t *rgba, int width, int height, bool bottom_up);
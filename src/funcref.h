@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature>
+class FunctionRef;
+
+// Non-owning reference to a callable, for callbacks that are only used
+// during the call they are passed to. Unlike std::function it never
+// allocates, but it must not outlive the callable.
+template <typename R, typename... Args>
+class FunctionRef<R (Args...)> {
+    void *obj;
+    R (*call)(void *obj, Args... args);
+
+public:
+    template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, FunctionRef>::value>>
+    FunctionRef(F &&fn):
+        obj(const_cast<void *>(static_cast<const void *>(std::addressof(fn)))),
+        call([](void *obj, Args... args) -> R {
+            return (*static_cast<std::remove_reference_t<F> *>(obj))(std::forward<Args>(args)...);
+        })
+    {
+    }
+
+    R operator()(Args... args) const
+    {
+        return call(obj, std::forward<Args>(args)...);
+    }
+};
@@ -1,41 +1,93 @@
 #pragma once
 
+#include <algorithm>
 #include <optional>
-#include <unordered_map>
 
+#include "cpuprofiler.h"
+#include "gpuprofiler.h"
 #include "input.h"
+#include "jobs.h"
+#include "latency.h"
 #include "object.h"
+#include "renderthread.h"
+#include "slotmap.h"
 
 struct SDL_Window;
 struct ImGuiIO;
+struct SoftRasterizer;
+struct SessionLog;
+
+typedef SlotHandle ObjectHandle;
 
 struct GameState {
-    std::optional<UuidRef> main_camera;
+    std::optional<ObjectHandle> main_camera;
 
-    std::unordered_map<UuidRef, Object> objects;
+    // Before the objects, which it has to outlive
+    World world;
+    // Adding or removing objects moves others, so hold handles rather than
+    // references across either
+    SlotMap<Object> objects;
 
     InputBuffer input_buf;
     Controller controller;
 
     bool running;
-    float time;
+    // Seconds since startup, kept in a double so it stays precise in long
+    // sessions. Whatever only needs a float, like the shaders, converts.
+    double time;
     float dt;
+    // CPU time of the last frame, from update to draw submission, or the
+    // render thread's time if that was longer
+    float cpu_frame_ms = 0;
+    // Set by the ResolutionScaler, multiplies every surface's grid resolution
+    float tess_scale = 1.f;
+    // Bytes of mesh data the GL backend uploads per frame, so a big mesh
+    // takes a few frames instead of stalling one. 0 for no limit.
+    size_t upload_budget = 0;
+
+    // Frames left to draw before the loop may block waiting for events.
+    // Anything that animates asks for another frame from its update.
+    unsigned redraw_frames = 0;
 
     SDL_Window *window;
     ImGuiIO *imgui_io;
+    CpuProfiler cpu_profiler;
+    GpuProfiler gpu_profiler;
+    LatencyTracker latency;
+    // Only set when drawing with RenderBackend::Software
+    SoftRasterizer *soft_raster = nullptr;
+    int view_w, view_h;
+    // Set while recording or replaying a session
+    SessionLog *session = nullptr;
+    JobScheduler jobs;
+    // Last, so its thread stops before anything it draws with goes away
+    RenderQueue render_queue { &gpu_profiler, &latency };
+
+
+    ObjectHandle add_object(Object object)
+    {
+        return objects.insert(std::move(object));
+    }
 
+    // Objects are only removed at the end of the frame, so the update and
+    // draw loops never see the map change under them
+    void remove_deleted_objects()
+    {
+        for (size_t i = objects.size(); i > 0; i--) {
+            if (objects.values[i - 1].deleted)
+                objects.erase(objects.handle_at(i - 1));
+        }
+    }
 
-    UuidRef add_object(Object object)
+    void request_redraw(unsigned frames = 1)
     {
-        UuidRef uuid = object.uuid;
-        objects[uuid] = std::move(object);
-        return uuid;
+        redraw_frames = std::max(redraw_frames, frames);
     }
 
-    UuidRef add_main_camera(Object object)
+    ObjectHandle add_main_camera(Object object)
     {
-        UuidRef uuid = add_object(std::move(object));
-        main_camera = uuid;
-        return uuid;
+        ObjectHandle handle = add_object(std::move(object));
+        main_camera = handle;
+        return handle;
     }
 };
@@ -0,0 +1,173 @@
+#include "gpuprofiler.h"
+
+#include <cstdint>
+
+#include <imgui.h>
+
+#include <GL/glew.h>
+
+#include "renderer.h"
+#include "trace.h"
+
+GpuProfiler::~GpuProfiler()
+{
+    release();
+}
+
+void GpuProfiler::release()
+{
+#ifndef __EMSCRIPTEN__
+    for (Frame &frame : frames) {
+        if (!frame.queries.empty())
+            glDeleteQueries(frame.queries.size(), &frame.queries[0]);
+        frame.queries.clear();
+        frame.labels.clear();
+        frame.used = 0;
+    }
+#endif
+    started = collected = 0;
+    recording = zone_open = false;
+}
+
+bool GpuProfiler::supported()
+{
+#ifdef __EMSCRIPTEN__
+    // WebGL only has timer queries behind EXT_disjoint_timer_query_webgl2
+    return false;
+#else
+    return render_backend == RenderBackend::GL;
+#endif
+}
+
+void GpuProfiler::begin_frame()
+{
+    if (!supported())
+        return;
+
+    if (zone_open)
+        end();
+
+    while (collected != started) {
+        if (!collect(&frames[collected % FRAMES]))
+            break;
+        collected++;
+    }
+
+    // Every set of queries is still in flight, so this frame goes untimed
+    recording = started - collected < FRAMES;
+    if (!recording)
+        return;
+
+    frames[started % FRAMES].used = 0;
+    started++;
+}
+
+void GpuProfiler::begin(const std::string &label)
+{
+    if (!recording || zone_open)
+        return;
+#ifndef __EMSCRIPTEN__
+    Frame &frame = frames[(started - 1) % FRAMES];
+    if (frame.used == frame.queries.size()) {
+        unsigned query;
+        glGenQueries(1, &query);
+        frame.queries.push_back(query);
+        frame.labels.emplace_back();
+    }
+
+    frame.labels[frame.used] = label;
+    glBeginQuery(GL_TIME_ELAPSED, frame.queries[frame.used]);
+    zone_open = true;
+#endif
+}
+
+void GpuProfiler::end()
+{
+    if (!zone_open)
+        return;
+#ifndef __EMSCRIPTEN__
+    glEndQuery(GL_TIME_ELAPSED);
+#endif
+    frames[(started - 1) % FRAMES].used++;
+    zone_open = false;
+}
+
+bool GpuProfiler::collect(Frame *frame)
+{
+#ifndef __EMSCRIPTEN__
+    if (frame->used == 0)
+        return true;
+
+    // Queries finish in order, so the last one stands for the frame
+    GLint available = 0;
+    glGetQueryObjectiv(frame->queries[frame->used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return false;
+
+    std::lock_guard<std::mutex> guard(results_lock);
+    zones.resize(frame->used);
+    total_ms = 0;
+    for (unsigned i = 0; i < frame->used; i++) {
+        GLuint64 elapsed_ns;
+        glGetQueryObjectui64v(frame->queries[i], GL_QUERY_RESULT, &elapsed_ns);
+        zones[i].label = frame->labels[i];
+        zones[i].ms = elapsed_ns / 1e6f;
+        total_ms += zones[i].ms;
+    }
+    results++;
+    // Lands a few frames after the frame it measured
+    TRACE_COUNTER("GPU frame (ms)", total_ms);
+#else
+    (void)frame;
+#endif
+    return true;
+}
+
+std::optional<float> GpuProfiler::zone_ms(const std::string &label) const
+{
+    std::lock_guard<std::mutex> guard(results_lock);
+    std::optional<float> ms;
+    for (const Zone &zone : zones) {
+        if (zone.label == label)
+            ms = ms.value_or(0) + zone.ms;
+    }
+    return ms;
+}
+
+std::optional<float> GpuProfiler::new_total(unsigned long *seen) const
+{
+    std::lock_guard<std::mutex> guard(results_lock);
+    if (results == *seen)
+        return {};
+    *seen = results;
+    return total_ms;
+}
+
+void GpuProfiler::draw_ui()
+{
+    if (!ImGui::CollapsingHeader("GPU Timings"))
+        return;
+
+    if (!supported()) {
+        ImGui::Text("Timer queries are not available.");
+        ImGui::Spacing();
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(results_lock);
+    ImGui::Columns(2, "GPU Timings");
+    for (const Zone &zone : zones) {
+        ImGui::Text("%s", zone.label.c_str());
+        ImGui::NextColumn();
+        ImGui::Text("%.3f ms", zone.ms);
+        ImGui::NextColumn();
+    }
+    ImGui::Separator();
+    ImGui::Text("Total");
+    ImGui::NextColumn();
+    ImGui::Text("%.3f ms", total_ms);
+    ImGui::NextColumn();
+    ImGui::Columns(1);
+
+    ImGui::Spacing();
+}
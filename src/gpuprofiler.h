@@ -0,0 +1,66 @@
+#pragma once
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Labeled GL_TIME_ELAPSED queries around each GPU pass of a frame. Every
+// frame gets its own set of queries, read back a few frames later so
+// collecting results never waits on the GPU. Zones can't nest.
+//
+// Frames are timed by whichever thread draws them, the results can be read
+// from any thread through the locking accessors.
+struct GpuProfiler {
+    // Frames that may be in flight before new ones go untimed
+    static constexpr unsigned FRAMES = 4;
+
+    struct Zone {
+        std::string label;
+        float ms;
+    };
+
+    // Newest finished frame, written under `results_lock`
+    std::vector<Zone> zones;
+    float total_ms = 0;
+    // Bumped every time zones is replaced
+    unsigned long results = 0;
+
+    GpuProfiler()
+    {
+    }
+    ~GpuProfiler();
+
+    GpuProfiler(const GpuProfiler &) = delete;
+    GpuProfiler &operator=(const GpuProfiler &) = delete;
+
+    // False on the software backend and under emscripten
+    static bool supported();
+
+    void begin_frame();
+    void begin(const std::string &label);
+    void end();
+    // Deletes the queries, on the thread that made them
+    void release();
+
+    std::optional<float> zone_ms(const std::string &label) const;
+    // The newest total, if there is one since `*seen` was last updated
+    std::optional<float> new_total(unsigned long *seen) const;
+    void draw_ui();
+
+private:
+    struct Frame {
+        std::vector<unsigned> queries;
+        std::vector<std::string> labels;
+        unsigned used = 0;
+    };
+
+    mutable std::mutex results_lock;
+    Frame frames[FRAMES];
+    // Frames started and read back so far
+    unsigned started = 0, collected = 0;
+    bool recording = false;
+    bool zone_open = false;
+
+    bool collect(Frame *frame);
+};
@@ -0,0 +1,99 @@
+#include "headless.h"
+
+#include <cstdio>
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+HeadlessContext::HeadlessContext():
+    display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT)
+{
+}
+
+std::optional<HeadlessContext> HeadlessContext::create()
+{
+    HeadlessContext out;
+
+    // Prefer Mesa's surfaceless platform so no X or Wayland server is needed
+    auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = EGL_NO_DISPLAY;
+    if (get_platform_display)
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY) {
+        printf("Failed to get an EGL display!\n");
+        return {};
+    }
+
+    EGLint major, minor;
+    if (!eglInitialize(display, &major, &minor)) {
+        printf("Failed to initialize EGL! Error=0x%x\n", eglGetError());
+        return {};
+    }
+    out.display = display;
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        printf("EGL does not support desktop GL!\n");
+        return {};
+    }
+
+    const EGLint config_attribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint num_configs;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || !num_configs) {
+        printf("No EGL config supports desktop GL!\n");
+        return {};
+    }
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE,
+    };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    if (context == EGL_NO_CONTEXT) {
+        printf("Failed to create an EGL context! Error=0x%x\n", eglGetError());
+        return {};
+    }
+    out.context = context;
+
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        printf("Failed to make the EGL context current! Error=0x%x\n", eglGetError());
+        return {};
+    }
+
+    glewExperimental = GL_TRUE;
+    GLenum ret = glewInit();
+    // GLEW built for GLX loads the core entry points and then complains
+    // that there is no X display, which is expected here
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if (ret == GLEW_ERROR_NO_GLX_DISPLAY)
+        ret = GLEW_OK;
+#endif
+    if (ret != GLEW_OK) {
+        printf("Failed to initialize GLEW!\n");
+        return {};
+    }
+
+    printf("Headless EGL %d.%d context ready\n", major, minor);
+    return out;
+}
+
+HeadlessContext::~HeadlessContext()
+{
+    if (!valid)
+        return;
+    if (context != EGL_NO_CONTEXT) {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+    }
+    if (display != EGL_NO_DISPLAY)
+        eglTerminate(display);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <optional>
+
+#include "resource.h"
+
+// GL context without a window or display server, for batch rendering on
+// machines that only have Mesa's software rasterizer. GL entry points are
+// loaded and ready once create() returns.
+struct HeadlessContext {
+    void *display;
+    void *context;
+
+    RESOURCE_IMPL(HeadlessContext);
+
+    static std::optional<HeadlessContext> create();
+    ~HeadlessContext();
+
+private:
+    HeadlessContext();
+};
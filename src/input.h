@@ -1,6 +1,7 @@
 #pragma once
 
-#include <deque>
+#include <atomic>
+#include <optional>
 
 #include "glm.h"
 
@@ -12,6 +13,9 @@ enum class InputType {
 };
 struct Input {
     InputType type;
+    // When it happened, in seconds on the GameState::time clock. A double
+    // so hours into a session it still tells inputs a frame apart.
+    double time;
 
     struct Digital {
         int source;
@@ -33,25 +37,67 @@ struct Input {
     };
 };
 
+// Fixed-size lock-free queue between one thread pushing inputs and one
+// thread popping them. Inputs pushed into a full ring are dropped, and the
+// consumer is told through `dropped` so it can forget any held keys.
 struct InputBuffer {
-    std::deque<Input> buf;
+    // A power of two, so the indices may wrap around
+    static constexpr unsigned CAPACITY = 256;
 
-    void push(Input input)
+    Input buf[CAPACITY];
+    std::atomic<bool> dropped { false };
+    // Written by the consumer and the producer respectively, kept on
+    // separate cache lines so they don't bounce between the two
+    alignas(64) std::atomic<unsigned> head { 0 };
+    alignas(64) std::atomic<unsigned> tail { 0 };
+
+    bool push(const Input &input)
     {
-        buf.push_back(input);
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == CAPACITY) {
+            dropped.store(true, std::memory_order_relaxed);
+            return false;
+        }
+        buf[t % CAPACITY] = input;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
     }
 
     std::optional<Input> pop()
     {
-        if (buf.empty())
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
             return {};
-        Input out = buf[0];
-        buf.pop_front();
+        Input out = buf[h % CAPACITY];
+        head.store(h + 1, std::memory_order_release);
         return out;
     }
 };
 
 struct Controller {
+    // Held right now
     glm::vec3 movement = glm::zero<glm::vec3>();
     glm::vec2 look = glm::zero<glm::vec2>();
+    // Held over the current frame, weighted by how many seconds each was
+    // held for. Cameras move by these rather than by the frame's dt.
+    glm::vec3 movement_held = glm::zero<glm::vec3>();
+    glm::vec2 look_held = glm::zero<glm::vec2>();
+    // Time up to which held input has been accumulated
+    double time = 0;
+
+    // Accumulates what is held up to `to`
+    void advance(double to)
+    {
+        if (to <= time)
+            return;
+        float held = (float)(to - time);
+        movement_held += held * movement;
+        look_held += held * look;
+        time = to;
+    }
+
+    bool moving() const
+    {
+        return movement_held != glm::zero<glm::vec3>() || look_held != glm::zero<glm::vec2>();
+    }
 };
@@ -0,0 +1,281 @@
+#include "jobs.h"
+
+#include <cstring>
+
+#include <imgui.h>
+
+#include "trace.h"
+
+static float Ms(JobScheduler::Clock::duration duration)
+{
+    return std::chrono::duration<float, std::milli>(duration).count();
+}
+
+static bool SameJob(const Job &a, const Job &b)
+{
+    return a.key && a.key == b.key && !strcmp(a.name, b.name);
+}
+
+JobScheduler::~JobScheduler()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quitting = true;
+        if (running)
+            running->cancel.cancel();
+    }
+    wake.notify_all();
+    if (thread.joinable())
+        thread.join();
+}
+
+void JobScheduler::submit(Job job)
+{
+    auto entry = std::make_unique<Entry>();
+    entry->submitted = Clock::now();
+    entry->due = entry->submitted + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(job.deadline));
+    entry->step = std::move(job.main);
+    entry->job = std::move(job);
+    bool background = (bool)entry->job.work;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        entry->order = next_order++;
+        submitted++;
+
+        // Whatever the earlier job would have produced is out of date
+        drop(entry->job);
+
+        if (background) {
+            queued.push_back(std::move(entry));
+            if (!thread.joinable())
+                thread = std::thread([this]() { worker(); });
+        } else {
+            entry->ready = entry->submitted;
+            ready.push_back(std::move(entry));
+        }
+    }
+    if (background)
+        wake.notify_one();
+}
+
+void JobScheduler::cancel(const char *name, uint64_t key)
+{
+    Job job;
+    job.name = name;
+    job.key = key;
+    std::lock_guard<std::mutex> guard(lock);
+    drop(job);
+}
+
+void JobScheduler::drop(const Job &job)
+{
+    auto drop_from = [&](std::vector<std::unique_ptr<Entry>> *entries) {
+        for (size_t i = entries->size(); i > 0; i--) {
+            Entry *other = (*entries)[i - 1].get();
+            if (!SameJob(other->job, job) || other->stale)
+                continue;
+            // Mid-step, step() retires it once it returns, and a step
+            // may well be queueing its own successor
+            if (other == stepping) {
+                other->stale = true;
+            } else {
+                coalesced++;
+                entries->erase(entries->begin() + (i - 1));
+            }
+        }
+    };
+    drop_from(&queued);
+    drop_from(&ready);
+    if (running && !running->stale && SameJob(running->job, job)) {
+        running->stale = true;
+        running->cancel.cancel();
+        coalesced++;
+    }
+}
+
+bool JobScheduler::busy()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return !queued.empty() || running || !ready.empty();
+}
+
+size_t JobScheduler::most_urgent(const std::vector<std::unique_ptr<Entry>> &entries)
+{
+    size_t best = 0;
+    for (size_t i = 1; i < entries.size(); i++) {
+        const Entry &a = *entries[i], &b = *entries[best];
+        if (a.job.priority != b.job.priority) {
+            if (a.job.priority < b.job.priority)
+                best = i;
+        } else if (a.due != b.due) {
+            if (a.due < b.due)
+                best = i;
+        } else if (a.order < b.order) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+void JobScheduler::complete(const Entry &entry)
+{
+    Clock::time_point now = Clock::now();
+    turnaround.add(Ms(now - entry.submitted));
+    completed++;
+    if (now > entry.due)
+        late++;
+}
+
+void JobScheduler::worker()
+{
+    TraceThreadName("Jobs");
+
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        wake.wait(guard, [&]() { return quitting || !queued.empty(); });
+        if (quitting)
+            return;
+
+        size_t next = most_urgent(queued);
+        std::unique_ptr<Entry> entry = std::move(queued[next]);
+        queued.erase(queued.begin() + next);
+        running = entry.get();
+        queue_wait.add(Ms(Clock::now() - entry->submitted));
+        guard.unlock();
+
+        MainStep step;
+        {
+            TRACE_SCOPE(entry->job.name);
+            step = entry->job.work(entry->cancel);
+        }
+
+        guard.lock();
+        running = nullptr;
+        if (!entry->stale) {
+            if (step) {
+                entry->step = std::move(step);
+                entry->ready = Clock::now();
+                ready.push_back(std::move(entry));
+            } else {
+                complete(*entry);
+            }
+        }
+        idle.notify_all();
+    }
+}
+
+void JobScheduler::step(Entry *entry)
+{
+    if (!entry->stepped) {
+        entry->stepped = true;
+        std::lock_guard<std::mutex> guard(lock);
+        main_wait.add(Ms(Clock::now() - entry->ready));
+    }
+
+    stepping = entry;
+    bool done;
+    {
+        TRACE_SCOPE(entry->job.name);
+        done = entry->step();
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    stepping = nullptr;
+    if (!done && !entry->stale)
+        return;
+    if (done)
+        complete(*entry);
+    else
+        coalesced++;
+    for (size_t i = 0; i < ready.size(); i++) {
+        if (ready[i].get() == entry) {
+            ready.erase(ready.begin() + i);
+            break;
+        }
+    }
+}
+
+void JobScheduler::run_main()
+{
+    if (synchronous) {
+        finish();
+        return;
+    }
+
+    Clock::time_point start = Clock::now();
+    for (bool first = true;; first = false) {
+        if (!first && Ms(Clock::now() - start) >= budget_ms)
+            break;
+
+        Entry *entry;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (ready.empty())
+                break;
+            entry = ready[most_urgent(ready)].get();
+        }
+        step(entry);
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    main_ms = Ms(Clock::now() - start);
+    TRACE_COUNTER("Queued Jobs", queued.size() + (running ? 1 : 0));
+    TRACE_COUNTER("Job Follow-ups", ready.size());
+}
+
+void JobScheduler::finish()
+{
+    for (;;) {
+        Entry *entry;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            idle.wait(guard, [&]() { return queued.empty() && !running; });
+            if (ready.empty())
+                return;
+            entry = ready[most_urgent(ready)].get();
+        }
+        step(entry);
+    }
+}
+
+void JobScheduler::draw_ui()
+{
+    if (!ImGui::CollapsingHeader("Background Jobs"))
+        return;
+
+    ImGui::SliderFloat("Main thread budget", &budget_ms, 0.f, 8.f, "%.1f ms");
+
+    std::lock_guard<std::mutex> guard(lock);
+    ImGui::Text("Queued: %zu, running: %d, follow-ups: %zu", queued.size(), running ? 1 : 0, ready.size());
+    ImGui::Text("Submitted: %lu, completed: %lu", submitted, completed);
+    ImGui::Text("Coalesced: %lu, late: %lu", coalesced, late);
+    ImGui::Text("Follow-ups last frame: %.2f ms", main_ms);
+
+    const LatencyTracker::Distribution *waits[] = { &queue_wait, &main_wait, &turnaround };
+    const char *names[] = { "Queued", "Follow-up", "Total" };
+    ImGui::Columns(4, "Background Jobs");
+    ImGui::Text("Wait");
+    ImGui::NextColumn();
+    ImGui::Text("p50");
+    ImGui::NextColumn();
+    ImGui::Text("p95");
+    ImGui::NextColumn();
+    ImGui::Text("max");
+    ImGui::NextColumn();
+    ImGui::Separator();
+    for (unsigned i = 0; i < 3; i++) {
+        ImGui::Text("%s", names[i]);
+        ImGui::NextColumn();
+        ImGui::Text("%.2f ms", waits[i]->percentile(0.50f));
+        ImGui::NextColumn();
+        ImGui::Text("%.2f ms", waits[i]->percentile(0.95f));
+        ImGui::NextColumn();
+        ImGui::Text("%.2f ms", waits[i]->max());
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+
+    ImGui::Spacing();
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "latency.h"
+#include "threadpool.h"
+
+// What's left of a job for the main thread, where GL may be used. Called
+// once per frame, within the frame's budget, until it returns true.
+typedef std::function<bool ()> MainStep;
+
+enum class JobPriority {
+    // The user is looking at the result
+    High,
+    Normal,
+    Low,
+};
+
+struct Job {
+    // Shown in traces and the UI, string literals are best
+    const char *name;
+    JobPriority priority = JobPriority::Normal;
+    // Seconds after submission it should be done by. Orders jobs of the
+    // same priority, and the job counts as late if it takes longer.
+    float deadline = 0.5f;
+    // A job replaces any earlier one of the same name and nonzero key,
+    // whether that's queued, running or waiting on the main thread
+    uint64_t key = 0;
+    // Runs on the background thread, and may spread over the shared pool.
+    // Should give up once `cancel` fires, since the result will be thrown
+    // away. Returns what's left for the main thread, if anything.
+    std::function<MainStep (const CancelToken &cancel)> work;
+    // For jobs with nothing to do in the background
+    MainStep main;
+};
+
+// Runs background jobs one at a time, most urgent first, on a thread of
+// its own so they never hold up the frame's compute passes. Their main
+// thread follow-ups are time-sliced: run_main() spends at most budget_ms
+// on them each frame, beyond the one step that always runs.
+struct JobScheduler {
+    typedef std::chrono::steady_clock Clock;
+
+    float budget_ms = 2.f;
+    // Every frame runs every job to completion, so frames come out the
+    // same from one run to the next
+    bool synchronous = false;
+
+    JobScheduler() = default;
+    JobScheduler(const JobScheduler &) = delete;
+    JobScheduler &operator=(const JobScheduler &) = delete;
+    ~JobScheduler();
+
+    // Main thread only, like everything else here but the jobs' work
+    void submit(Job job);
+    // Drops the job of that name and key, like submitting a replacement would
+    void cancel(const char *name, uint64_t key);
+    // Whether anything is queued, running or waiting on the main thread
+    bool busy();
+
+    // Once per frame
+    void run_main();
+    // Returns once nothing is queued, running or waiting on the main thread
+    void finish();
+
+    void draw_ui();
+
+private:
+    struct Entry {
+        Job job;
+        uint64_t order;
+        Clock::time_point submitted, due, ready;
+        CancelToken cancel;
+        MainStep step;
+        bool stepped = false;
+        // Replaced by a later job while running or mid-step
+        bool stale = false;
+    };
+
+    std::mutex lock;
+    std::condition_variable wake, idle;
+    std::vector<std::unique_ptr<Entry>> queued;
+    Entry *running = nullptr;
+    // Follow-ups, only removed from by the main thread
+    std::vector<std::unique_ptr<Entry>> ready;
+    Entry *stepping = nullptr;
+    uint64_t next_order = 0;
+    std::thread thread;
+    bool quitting = false;
+
+    // Under `lock`, like the queues
+    LatencyTracker::Distribution queue_wait, main_wait, turnaround;
+    unsigned long submitted = 0, completed = 0, coalesced = 0, late = 0;
+    float main_ms = 0;
+
+    void worker();
+    // Under `lock`
+    void drop(const Job &job);
+    void step(Entry *entry);
+    void complete(const Entry &entry);
+    static size_t most_urgent(const std::vector<std::unique_ptr<Entry>> &entries);
+};
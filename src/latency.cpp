@@ -0,0 +1,201 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include <SDL.h>
+#include <GL/glew.h>
+
+#include <imgui.h>
+
+#include "renderer.h"
+#include "trace.h"
+
+// Key held down by synthetic input, turns the camera
+#define SYNTHETIC_KEY SDL_SCANCODE_LEFT
+// Upper bound on a blocking collect()
+#define FENCE_TIMEOUT_NS 1000000000ull
+
+static double Now()
+{
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+static bool FencesSupported()
+{
+    return render_backend == RenderBackend::GL;
+}
+
+void LatencyTracker::Distribution::add(float ms)
+{
+    samples[count % HISTORY] = ms;
+    count++;
+}
+
+float LatencyTracker::Distribution::percentile(float p) const
+{
+    unsigned n = std::min(count, HISTORY);
+    if (!n)
+        return 0;
+    float sorted[HISTORY];
+    std::copy(samples, samples + n, sorted);
+    float *nth = sorted + (size_t)(p * (n - 1));
+    std::nth_element(sorted, nth, sorted + n);
+    return *nth;
+}
+
+float LatencyTracker::Distribution::max() const
+{
+    unsigned n = std::min(count, HISTORY);
+    return n ? *std::max_element(samples, samples + n) : 0;
+}
+
+LatencyTracker::~LatencyTracker()
+{
+    for (Frame &frame : pending) {
+        if (frame.fence)
+            glDeleteSync((GLsync)frame.fence);
+    }
+}
+
+const char *LatencyTracker::stage_name(Stage stage)
+{
+    switch (stage) {
+    case Consumed:  return "Consumed";
+    case Simulated: return "Simulated";
+    case Submitted: return "Submitted";
+    case Presented: return "Presented";
+    case Completed: return "GPU done";
+    default:        return "?";
+    }
+}
+
+void LatencyTracker::begin_frame(double time)
+{
+    clock_offset = Now() - time;
+    current.count = 0;
+}
+
+void LatencyTracker::synthesize(InputBuffer *input_buf, double time)
+{
+    if (!synthetic_period || ++synthetic_frame < synthetic_period)
+        return;
+    synthetic_frame = 0;
+    synthetic_pressed = !synthetic_pressed;
+
+    Input input;
+    input.type = InputType::Key;
+    input.time = time;
+    input.digital = { SYNTHETIC_KEY, synthetic_pressed };
+    input_buf->push(input);
+}
+
+void LatencyTracker::consume(const Input *inputs, size_t count)
+{
+    for (size_t i = 0; i < count && current.count < MAX_INPUTS; i++) {
+        if (inputs[i].type != InputType::Reset)
+            current.received[current.count++] = inputs[i].time + clock_offset;
+    }
+    mark(Consumed);
+}
+
+void LatencyTracker::mark(const Inputs &inputs, Stage stage)
+{
+    add_samples(inputs, stage, Now());
+}
+
+void LatencyTracker::end_frame(const Inputs &inputs)
+{
+    if (!inputs.count || !FencesSupported())
+        return;
+
+    // Nothing is waited on, the oldest frame is given up on instead
+    Frame &slot = pending[fenced % FRAMES];
+    if (fenced - collected == FRAMES) {
+        glDeleteSync((GLsync)slot.fence);
+        collected++;
+    }
+    slot.inputs = inputs;
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    fenced++;
+}
+
+void LatencyTracker::collect(bool wait)
+{
+    while (collected != fenced) {
+        Frame &frame = pending[collected % FRAMES];
+        GLenum status = glClientWaitSync((GLsync)frame.fence,
+            wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? FENCE_TIMEOUT_NS : 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        // Polled rather than waited on, so this overestimates by up to a frame
+        add_samples(frame.inputs, Completed, Now());
+        glDeleteSync((GLsync)frame.fence);
+        frame.fence = nullptr;
+        collected++;
+    }
+}
+
+void LatencyTracker::add_samples(const Inputs &inputs, Stage stage, double now)
+{
+    if (!inputs.count)
+        return;
+    std::lock_guard<std::mutex> guard(lock);
+    for (unsigned i = 0; i < inputs.count; i++)
+        stages[stage].add((now - inputs.received[i]) * 1000);
+    if (stage == Presented)
+        TRACE_COUNTER("Input latency (ms)", (now - inputs.received[0]) * 1000);
+}
+
+void LatencyTracker::draw_ui()
+{
+    if (!ImGui::CollapsingHeader("Input Latency"))
+        return;
+
+    bool synthetic = synthetic_period != 0;
+    if (ImGui::Checkbox("Synthetic input", &synthetic))
+        synthetic_period = synthetic ? 30 : 0;
+
+    std::lock_guard<std::mutex> guard(lock);
+    ImGui::Columns(4, "Input Latency");
+    ImGui::Text("Stage");
+    ImGui::NextColumn();
+    ImGui::Text("p50");
+    ImGui::NextColumn();
+    ImGui::Text("p95");
+    ImGui::NextColumn();
+    ImGui::Text("max");
+    ImGui::NextColumn();
+    ImGui::Separator();
+    for (unsigned i = 0; i < STAGES; i++) {
+        const Distribution &dist = stages[i];
+        ImGui::Text("%s", stage_name((Stage)i));
+        ImGui::NextColumn();
+        ImGui::Text("%.2f ms", dist.percentile(0.50f));
+        ImGui::NextColumn();
+        ImGui::Text("%.2f ms", dist.percentile(0.95f));
+        ImGui::NextColumn();
+        ImGui::Text("%.2f ms", dist.max());
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+
+    ImGui::Spacing();
+}
+
+void LatencyTracker::print()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    unsigned inputs = stages[Consumed].count;
+    printf("Input latency over the last %u of %u inputs:\n", std::min(inputs, HISTORY), inputs);
+    for (unsigned i = 0; i < STAGES; i++) {
+        const Distribution &dist = stages[i];
+        if (!dist.count)
+            continue;
+        printf("  %-10s p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms\n", stage_name((Stage)i),
+            dist.percentile(0.50f), dist.percentile(0.95f), dist.percentile(0.99f), dist.max());
+    }
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+#include "input.h"
+
+// Follows every input consumed by Update through the frame that handles
+// it: until the frame consumed it, finished simulating, submitted its
+// draws, was presented, and until the GPU finished it, seen through a
+// fence polled with the next frames, or on its own if none come. Each
+// stage keeps the latency of the last HISTORY inputs, measured from when
+// the input was read.
+//
+// The simulation marks the first two stages. Drawing may happen on another
+// thread, which marks the rest with the inputs carried in its snapshot.
+struct LatencyTracker {
+    enum Stage {
+        Consumed,
+        Simulated,
+        Submitted,
+        Presented,
+        Completed,
+        STAGES,
+    };
+
+    static constexpr unsigned HISTORY = 240;
+    // Inputs followed per frame, the rest of a burst is ignored
+    static constexpr unsigned MAX_INPUTS = 16;
+    // Frames whose fences may be outstanding, older ones are given up on
+    static constexpr unsigned FRAMES = 4;
+
+    // Times the inputs of one frame were read, on this tracker's clock
+    struct Inputs {
+        float received[MAX_INPUTS];
+        unsigned count = 0;
+    };
+
+    struct Distribution {
+        float samples[HISTORY] = {};
+        unsigned count = 0;
+
+        void add(float ms);
+        // Over the samples kept, 0 if there are none
+        float percentile(float p) const;
+        float max() const;
+    };
+
+    // Read under `lock` while frames are being drawn on another thread
+    Distribution stages[STAGES];
+
+    // Presses a key every this many frames and releases it as many frames
+    // later, so latency can be measured without anyone at the keyboard.
+    // 0 turns it off.
+    unsigned synthetic_period = 0;
+
+    LatencyTracker() = default;
+    LatencyTracker(const LatencyTracker &) = delete;
+    ~LatencyTracker();
+
+    static const char *stage_name(Stage stage);
+
+    // `time` is the frame's GameState::time, inputs are stamped on its clock
+    void begin_frame(double time);
+    void synthesize(InputBuffer *input_buf, double time);
+    void consume(const Input *inputs, size_t count);
+
+    // The inputs consumed this frame
+    const Inputs &frame_inputs() const
+    {
+        return current;
+    }
+
+    void mark(Stage stage)
+    {
+        mark(current, stage);
+    }
+    void mark(const Inputs &inputs, Stage stage);
+
+    // Fences the frame once presented, so its completion can be seen. This
+    // and collect() are called where the frame was drawn.
+    void end_frame()
+    {
+        end_frame(current);
+    }
+    void end_frame(const Inputs &inputs);
+    // Polls the fences of earlier frames, with `wait` blocks until every
+    // fenced frame has finished
+    void collect(bool wait);
+    // Whether a fenced frame hasn't been seen finishing yet, so whoever
+    // draws should keep calling collect() even with nothing to draw.
+    // Safe from any thread.
+    bool outstanding() const
+    {
+        return collected.load(std::memory_order_relaxed) != fenced.load(std::memory_order_relaxed);
+    }
+
+    void draw_ui();
+    void print();
+
+private:
+    struct Frame {
+        Inputs inputs;
+        void *fence = nullptr;
+    };
+
+    // Real time minus GameState::time, for this frame
+    double clock_offset = 0;
+    unsigned synthetic_frame = 0;
+    bool synthetic_pressed = false;
+
+    Inputs current;
+    Frame pending[FRAMES];
+    // Frames fenced and collected so far, only changed where the frames
+    // are drawn
+    std::atomic<unsigned> fenced { 0 }, collected { 0 };
+
+    std::mutex lock;
+
+    void add_samples(const Inputs &inputs, Stage stage, double now);
+};
@@ -0,0 +1,466 @@
+#include "lod.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "threadpool.h"
+#include "trace.h"
+
+// Vertices and triangles of one patch
+#define PATCH_VERTS ((PatchTree::PATCH_RES + 1) * (PatchTree::PATCH_RES + 1))
+#define PATCH_TRIS (PatchTree::PATCH_RES * PatchTree::PATCH_RES * 2)
+
+// Edges of a patch that meet a coarser neighbor
+enum : unsigned char {
+    STITCH_WEST = 1 << 0,
+    STITCH_EAST = 1 << 1,
+    STITCH_SOUTH = 1 << 2,
+    STITCH_NORTH = 1 << 3,
+    // Slot with nothing written to it yet
+    STITCH_UNKNOWN = 0xff,
+};
+
+// Slots the mesh starts with
+#define FIRST_SLOTS 64
+
+// Where lattice lines fall in the domain, matching CreateGridMesh for a
+// LATTICE x LATTICE grid
+static float LatticeCoord(unsigned g, float min, float max)
+{
+    float fract = (float)g / (float)(PatchTree::LATTICE + 1);
+    return min + fract * (max - min);
+}
+
+void PatchTree::reset(float u_min, float u_max, float v_min, float v_max)
+{
+    this->u_min = u_min;
+    this->u_max = u_max;
+    this->v_min = v_min;
+    this->v_max = v_max;
+
+    nodes.clear();
+    free_blocks.clear();
+    slot_nodes.clear();
+    free_slots.clear();
+    slot_stitch.clear();
+    slot_dirty.clear();
+    capacity = 0;
+    nodes.emplace_back();
+    Node &root = nodes.back();
+    root.depth = root.x = root.y = 0;
+    sample(&root, bounds_time);
+    take_slot(0);
+    refresh_next = 0;
+    built = false;
+}
+
+bool PatchTree::set_equations(const std::string &x, const std::string &y, const std::string &z, bool time_dependent)
+{
+    const std::string *srcs[] = { &x, &y, &z };
+    ExprRef parsed[3];
+    for (int i = 0; i < 3; i++) {
+        auto expr = Expr::parse(*srcs[i]);
+        if (!expr)
+            return false;
+        parsed[i] = *expr;
+    }
+
+    for (int i = 0; i < 3; i++)
+        xyz[i] = std::move(parsed[i]);
+    animated = time_dependent;
+    for (Node &node : nodes) {
+        if (!node.unused)
+            sample(&node, bounds_time);
+    }
+    return true;
+}
+
+glm::vec3 PatchTree::eval(unsigned gx, unsigned gy, float time) const
+{
+    float u = LatticeCoord(gx, u_min, u_max);
+    float v = LatticeCoord(gy, v_min, v_max);
+    if (!xyz[0])
+        return glm::vec3(u, 0.f, v);
+    return glm::vec3(xyz[0]->eval(u, v, time), xyz[1]->eval(u, v, time), xyz[2]->eval(u, v, time));
+}
+
+// Bounds and quad size from a 3x3 sampling of the patch
+void PatchTree::sample(Node *node, float time)
+{
+    unsigned size = LATTICE >> node->depth;
+    unsigned x0 = node->x * size, y0 = node->y * size;
+
+    glm::vec3 points[3][3];
+    for (unsigned i = 0; i < 3; i++) {
+        for (unsigned j = 0; j < 3; j++)
+            points[i][j] = eval(x0 + i * size / 2, y0 + j * size / 2, time);
+    }
+
+    node->lo = node->hi = points[0][0];
+    float span = 0;
+    for (unsigned i = 0; i < 3; i++) {
+        for (unsigned j = 0; j < 3; j++) {
+            node->lo = glm::min(node->lo, points[i][j]);
+            node->hi = glm::max(node->hi, points[i][j]);
+            if (i < 2)
+                span = std::max(span, glm::length(points[i + 1][j] - points[i][j]));
+            if (j < 2)
+                span = std::max(span, glm::length(points[i][j + 1] - points[i][j]));
+        }
+    }
+    // Each span covers half the patch
+    node->quad = span / (PATCH_RES / 2);
+}
+
+// How big the node's quads come out on screen, in pixels, or 0 if it's
+// out of view
+float PatchTree::error(const Node &node, const LodView &view) const
+{
+    // Outside the frustum if every corner is beyond the same plane
+    unsigned outside[6] = {};
+    for (unsigned c = 0; c < 8; c++) {
+        glm::vec3 corner((c & 1) ? node.hi.x : node.lo.x, (c & 2) ? node.hi.y : node.lo.y,
+            (c & 4) ? node.hi.z : node.lo.z);
+        glm::vec4 clip = view.view_proj * glm::vec4(corner, 1.f);
+        outside[0] += clip.x < -clip.w;
+        outside[1] += clip.x > clip.w;
+        outside[2] += clip.y < -clip.w;
+        outside[3] += clip.y > clip.w;
+        outside[4] += clip.z < -clip.w;
+        outside[5] += clip.z > clip.w;
+    }
+    for (unsigned count : outside) {
+        if (count == 8)
+            return 0.f;
+    }
+
+    glm::vec3 nearest = glm::clamp(view.eye, node.lo, node.hi);
+    float distance = std::max(glm::length(view.eye - nearest), 1e-4f);
+    return node.quad * view.pixels_per_unit / distance;
+}
+
+void PatchTree::take_slot(int index)
+{
+    int slot;
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        slot = slot_nodes.size();
+        slot_nodes.push_back(-1);
+        slot_stitch.push_back(STITCH_UNKNOWN);
+        slot_dirty.push_back(1);
+    }
+    slot_nodes[slot] = index;
+    slot_dirty[slot] = 1;
+    nodes[index].slot = slot;
+}
+
+void PatchTree::free_slot(int index)
+{
+    int slot = nodes[index].slot;
+    slot_nodes[slot] = -1;
+    slot_dirty[slot] = 1;
+    free_slots.push_back(slot);
+    nodes[index].slot = -1;
+}
+
+// The node at `depth` covering patch (x, y) of that depth, or the leaf
+// covering it if that's coarser. -1 outside the domain.
+int PatchTree::find(unsigned depth, int x, int y) const
+{
+    int side = 1 << depth;
+    if (x < 0 || y < 0 || x >= side || y >= side)
+        return -1;
+
+    int index = 0;
+    while (nodes[index].children >= 0 && nodes[index].depth < depth) {
+        unsigned shift = depth - nodes[index].depth - 1;
+        int child = ((x >> shift) & 1) + 2 * ((y >> shift) & 1);
+        index = nodes[index].children + child;
+    }
+    return index;
+}
+
+// The leaf across the given side, if it's coarser than the node
+int PatchTree::coarser_neighbor(const Node &node, int dx, int dy) const
+{
+    int neighbor = find(node.depth, (int)node.x + dx, (int)node.y + dy);
+    if (neighbor < 0 || nodes[neighbor].depth >= node.depth)
+        return -1;
+    return neighbor;
+}
+
+void PatchTree::split(int index, float time)
+{
+    // Neighbors a level up would end up two levels from the children
+    static const int sides[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+    for (const int *side : sides) {
+        int neighbor = coarser_neighbor(nodes[index], side[0], side[1]);
+        if (neighbor >= 0)
+            split(neighbor, time);
+    }
+
+    int block;
+    if (!free_blocks.empty()) {
+        block = free_blocks.back();
+        free_blocks.pop_back();
+    } else {
+        block = nodes.size();
+        nodes.resize(nodes.size() + 4);
+    }
+
+    free_slot(index);
+    Node parent = nodes[index];
+    for (int i = 0; i < 4; i++) {
+        Node &child = nodes[block + i];
+        child = Node();
+        child.depth = parent.depth + 1;
+        child.x = parent.x * 2 + (i & 1);
+        child.y = parent.y * 2 + (i >> 1);
+        child.parent = index;
+        sample(&child, time);
+        take_slot(block + i);
+    }
+    nodes[index].children = block;
+    counts.splits++;
+}
+
+// Whether the node's children are leaves, and none of the leaves around
+// them is finer still
+bool PatchTree::can_merge(int index) const
+{
+    const Node &node = nodes[index];
+    if (node.children < 0)
+        return false;
+
+    for (int i = 0; i < 4; i++) {
+        const Node &child = nodes[node.children + i];
+        if (child.children >= 0)
+            return false;
+
+        int dx = (i & 1) ? 1 : -1, dy = (i >> 1) ? 1 : -1;
+        int across[2] = { find(child.depth, (int)child.x + dx, (int)child.y),
+            find(child.depth, (int)child.x, (int)child.y + dy) };
+        for (int neighbor : across) {
+            if (neighbor >= 0 && nodes[neighbor].depth == child.depth && nodes[neighbor].children >= 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+void PatchTree::merge(int index)
+{
+    int block = nodes[index].children;
+    for (int i = 0; i < 4; i++) {
+        free_slot(block + i);
+        nodes[block + i].unused = true;
+    }
+    free_blocks.push_back(block);
+    nodes[index].children = -1;
+    take_slot(index);
+    counts.merges++;
+}
+
+bool PatchTree::update(const LodView &view, const LodParams &params, float time)
+{
+    TRACE_SCOPE("PatchTree::update");
+    if (nodes.empty())
+        return false;
+
+    bounds_time = time;
+    if (animated) {
+        for (unsigned i = 0; i < REFRESH_NODES && i < nodes.size(); i++) {
+            refresh_next = (refresh_next + 1) % nodes.size();
+            if (!nodes[refresh_next].unused)
+                sample(&nodes[refresh_next], time);
+        }
+    }
+
+    unsigned leaf_count = 0;
+    splits.clear();
+    merges.clear();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        Node &node = nodes[i];
+        if (node.unused)
+            continue;
+        node.error = error(node, view);
+
+        if (node.children < 0) {
+            leaf_count++;
+            if (node.depth < MAX_DEPTH && node.error > params.max_error)
+                splits.push_back(i);
+            continue;
+        }
+        bool leaf_children = true;
+        for (int c = 0; c < 4; c++)
+            leaf_children &= nodes[node.children + c].children < 0;
+        if (leaf_children)
+            merges.push_back(i);
+    }
+
+    std::sort(splits.begin(), splits.end(), [&](int a, int b) { return nodes[a].error > nodes[b].error; });
+    std::sort(merges.begin(), merges.end(), [&](int a, int b) { return nodes[a].error < nodes[b].error; });
+
+    unsigned budget = std::max(1u, params.max_patches);
+    unsigned changes = 0;
+    size_t next_merge = 0;
+
+    // Drop detail nobody needs, or that's over budget. Merged nodes have
+    // to be well under the limit, or they'd split again right away.
+    for (; next_merge < merges.size() && changes < MAX_CHANGES; next_merge++) {
+        int index = merges[next_merge];
+        if (nodes[index].error >= params.max_error / 2 && leaf_count <= budget)
+            break;
+        if (!can_merge(index))
+            continue;
+        merge(index);
+        leaf_count -= 3;
+        changes++;
+    }
+
+    // Add it where it's missing the most. Once over budget, each split
+    // trades for a merge where detail is needed far less.
+    for (int index : splits) {
+        if (changes >= MAX_CHANGES)
+            break;
+        if (nodes[index].unused || nodes[index].children >= 0)
+            continue;
+
+        if (leaf_count + 3 > budget) {
+            while (next_merge < merges.size()) {
+                int other = merges[next_merge];
+                if (nodes[other].error * 2 >= nodes[index].error)
+                    break;
+                next_merge++;
+                if (other != nodes[index].parent && can_merge(other)) {
+                    merge(other);
+                    leaf_count -= 3;
+                    changes++;
+                    break;
+                }
+            }
+            if (leaf_count + 3 > budget)
+                break;
+        }
+
+        unsigned long before = counts.splits;
+        split(index, time);
+        leaf_count += 3 * (counts.splits - before);
+        changes++;
+    }
+
+    counts.leaves = leaf_count;
+    counts.nodes = nodes.size() - 4 * free_blocks.size();
+    return changes > 0 || !built;
+}
+
+bool PatchTree::build(std::vector<Vertex> *vertices, std::vector<VIndices> *indices, std::vector<MeshRange> *ranges,
+    ThreadPool *pool)
+{
+    TRACE_SCOPE("PatchTree::build");
+
+    // Out of slots, or the mesh isn't the one last built
+    bool full = slot_nodes.size() > capacity || vertices->size() != capacity * PATCH_VERTS;
+    if (full) {
+        capacity = std::max<size_t>(capacity, FIRST_SLOTS);
+        while (capacity < slot_nodes.size())
+            capacity *= 2;
+    }
+
+    writes.clear();
+    counts.depth = 0;
+    for (size_t s = 0; s < slot_nodes.size(); s++) {
+        unsigned char stitch = 0;
+        if (slot_nodes[s] >= 0) {
+            const Node &node = nodes[slot_nodes[s]];
+            if (coarser_neighbor(node, -1, 0) >= 0)
+                stitch |= STITCH_WEST;
+            if (coarser_neighbor(node, 1, 0) >= 0)
+                stitch |= STITCH_EAST;
+            if (coarser_neighbor(node, 0, -1) >= 0)
+                stitch |= STITCH_SOUTH;
+            if (coarser_neighbor(node, 0, 1) >= 0)
+                stitch |= STITCH_NORTH;
+            counts.depth = std::max(counts.depth, node.depth);
+        }
+        if (full || slot_dirty[s] || slot_stitch[s] != stitch)
+            writes.push_back(s);
+        slot_stitch[s] = stitch;
+        slot_dirty[s] = 0;
+    }
+
+    unsigned verts = PATCH_RES + 1;
+    if (full) {
+        // Every patch has the same triangles, so only new ones need indices
+        size_t patches = indices->size() / PATCH_TRIS;
+        indices->resize(capacity * PATCH_TRIS);
+        for (size_t p = patches; p < capacity; p++) {
+            unsigned base = p * PATCH_VERTS;
+            VIndices *dst = &(*indices)[p * PATCH_TRIS];
+            for (unsigned i = 0; i < PATCH_RES; i++) {
+                for (unsigned j = 0; j < PATCH_RES; j++) {
+                    unsigned offs = 2 * (i*PATCH_RES + j);
+                    dst[offs]   = { base + (i+0)*verts+(j+0), base + (i+1)*verts+(j+0), base + (i+0)*verts+(j+1) };
+                    dst[offs+1] = { base + (i+1)*verts+(j+1), base + (i+1)*verts+(j+0), base + (i+0)*verts+(j+1) };
+                }
+            }
+        }
+
+        // Slots nobody has taken yet
+        vertices->resize(capacity * PATCH_VERTS);
+        float u = LatticeCoord(0, u_min, u_max), v = LatticeCoord(0, v_min, v_max);
+        std::fill(vertices->begin() + slot_nodes.size() * PATCH_VERTS, vertices->end(), Vertex{ u, -1, v, 0, 0 });
+    }
+
+    pool->parallel_for(writes.size(), 16, [&](size_t begin, size_t end) {
+        for (size_t w = begin; w < end; w++) {
+            int slot = writes[w];
+            Vertex *dst = &(*vertices)[slot * PATCH_VERTS];
+            // Free slots collapse to a point, drawing nothing
+            if (slot_nodes[slot] < 0) {
+                float u = LatticeCoord(0, u_min, u_max), v = LatticeCoord(0, v_min, v_max);
+                std::fill(dst, dst + PATCH_VERTS, Vertex{ u, -1, v, 0, 0 });
+                continue;
+            }
+
+            const Node &node = nodes[slot_nodes[slot]];
+            unsigned char stitch = slot_stitch[slot];
+            unsigned size = LATTICE >> node.depth;
+            unsigned step = size / PATCH_RES;
+            unsigned x0 = node.x * size, y0 = node.y * size;
+
+            for (unsigned i = 0; i < verts; i++) {
+                for (unsigned j = 0; j < verts; j++) {
+                    unsigned gx = x0 + i * step, gy = y0 + j * step;
+                    // Onto the coarser neighbor's vertex before it, leaving
+                    // a degenerate triangle instead of a crack
+                    if ((j & 1) && (((stitch & STITCH_WEST) && i == 0) || ((stitch & STITCH_EAST) && i == PATCH_RES)))
+                        gy -= step;
+                    if ((i & 1) && (((stitch & STITCH_SOUTH) && j == 0) || ((stitch & STITCH_NORTH) && j == PATCH_RES)))
+                        gx -= step;
+
+                    float u = LatticeCoord(gx, u_min, u_max);
+                    float v = LatticeCoord(gy, v_min, v_max);
+                    // Lattice indices for the lookup tables, like CreateGridMesh
+                    dst[i*verts+j] = { u, -1, v, (float)gx, (float)gy };
+                }
+            }
+        }
+    });
+    built = true;
+    counts.builds++;
+
+    if (full)
+        return true;
+    // Neighboring slots go as one range
+    for (int slot : writes) {
+        size_t first = (size_t)slot * PATCH_VERTS;
+        if (!ranges->empty() && ranges->back().first + ranges->back().count == first)
+            ranges->back().count += PATCH_VERTS;
+        else
+            ranges->push_back({ first, PATCH_VERTS });
+    }
+    return false;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "glm.h"
+#include "expr.h"
+#include "renderer.h"
+
+struct ThreadPool;
+
+struct LodParams {
+    bool adaptive = false;
+    // Largest a patch's quads may get on screen, in pixels
+    float max_error = 8.f;
+    // Leaves past which splitting one means merging another
+    unsigned max_patches = 512;
+};
+
+// What picking levels needs to know about the camera
+struct LodView {
+    glm::mat4 view_proj;
+    glm::vec3 eye;
+    // Pixels covered by a unit of length one unit in front of the camera
+    float pixels_per_unit;
+};
+
+// Splits a surface's (u, v) domain into a quadtree of patches, each a grid
+// of PATCH_RES quads a side, and refines it where quads come out bigger on
+// screen than LodParams::max_error. Every patch samples the same lattice of
+// LATTICE lines a side, so shared edges evaluate to the same positions.
+//
+// Neighboring leaves are never more than a level apart, and a patch next to
+// a coarser one snaps every other vertex along that edge onto its neighbor's,
+// so the seam has no cracks. The tree changes by at most MAX_CHANGES splits
+// and merges per update, beyond those that keep it balanced.
+//
+// Each leaf keeps its slot of PATCH_VERTS vertices in the mesh for as long as
+// it's a leaf, so a build only rewrites the slots whose patch or stitching
+// changed. The slots double when they run out, which is when the whole mesh
+// is rewritten.
+struct PatchTree {
+    static constexpr unsigned PATCH_RES = 16;
+    static constexpr unsigned MAX_DEPTH = 8;
+    static constexpr unsigned LATTICE = PATCH_RES << MAX_DEPTH;
+    static constexpr unsigned MAX_CHANGES = 32;
+    // Nodes whose bounds are sampled again per update, for surfaces that
+    // move over time
+    static constexpr unsigned REFRESH_NODES = 64;
+
+    struct Stats {
+        unsigned leaves = 0, nodes = 0, depth = 0;
+        unsigned long splits = 0, merges = 0, builds = 0;
+    };
+
+    // Starts over from a single patch, which update() refines
+    void reset(float u_min, float u_max, float v_min, float v_max);
+    // Returns false if the equations can't be evaluated here
+    bool set_equations(const std::string &x, const std::string &y, const std::string &z, bool time_dependent);
+
+    // Returns whether the leaves changed, in which case build() is due
+    bool update(const LodView &view, const LodParams &params, float time);
+    // Returns true if it rewrote the whole mesh, otherwise appends the
+    // vertices it changed to `ranges`
+    bool build(std::vector<Vertex> *vertices, std::vector<VIndices> *indices, std::vector<MeshRange> *ranges,
+        ThreadPool *pool);
+
+    const Stats &stats() const
+    {
+        return counts;
+    }
+
+private:
+    struct Node {
+        unsigned depth = 0, x = 0, y = 0;
+        int parent = -1;
+        // The four children are allocated together, in x then y order
+        int children = -1;
+        glm::vec3 lo, hi;
+        // Length of one of its quads, about
+        float quad = 0;
+        float error = 0;
+        // Merged away, its block waiting to be reused
+        bool unused = false;
+        // Where its vertices go in the mesh while it's a leaf
+        int slot = -1;
+    };
+
+    std::vector<Node> nodes;
+    // Free blocks of four children
+    std::vector<int> free_blocks;
+    float u_min = 0, u_max = 0, v_min = 0, v_max = 0;
+    ExprRef xyz[3];
+    bool animated = false;
+    // Whether the last build has the current leaves
+    bool built = false;
+    float bounds_time = 0;
+    size_t refresh_next = 0;
+
+    // Leaf in each slot, or -1
+    std::vector<int> slot_nodes;
+    std::vector<int> free_slots;
+    // Stitching each slot was last written with, and whether it needs
+    // writing again
+    std::vector<unsigned char> slot_stitch, slot_dirty;
+    // Slots in the mesh last built
+    size_t capacity = 0;
+
+    // Reused between updates
+    std::vector<int> splits, merges, writes;
+
+    Stats counts;
+
+    glm::vec3 eval(unsigned gx, unsigned gy, float time) const;
+    void sample(Node *node, float time);
+    float error(const Node &node, const LodView &view) const;
+
+    int find(unsigned depth, int x, int y) const;
+    int coarser_neighbor(const Node &node, int dx, int dy) const;
+    void split(int index, float time);
+    bool can_merge(int index) const;
+    void merge(int index);
+    void take_slot(int index);
+    void free_slot(int index);
+};
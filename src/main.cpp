@@ -1,5 +1,8 @@
 #include <optional>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <cstdint>
 #include <deque>
 #include <unordered_map>
@@ -17,81 +20,40 @@
 #include <imgui_impl_sdl.h>
 #include <imgui_impl_opengl3.h>
 
+#include "alloctrack.h"
+#include "arena.h"
 #include "axes.h"
 #include "glm.h"
 #include "game.h"
 #include "camera.h"
 #include "defer.h"
+#include "frame.h"
+#include "framebuffer.h"
 #include "resource.h"
 #include "surface.h"
 #include "object.h"
 #include "renderer.h"
+#include "replay.h"
+#include "resscale.h"
+#include "softraster.h"
+#include "threadpool.h"
+#include "trace.h"
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #endif
 
+#ifdef HEADLESS_EGL
+#include "headless.h"
+#endif
 
-void DrawFrame(GameState *ctx)
-{
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    Object &cam_obj = ctx->objects.at(ctx->main_camera.value());
-    Camera &cam = cam_obj.component<Camera>().value();
-
-    for (auto it = ctx->objects.begin(); it != ctx->objects.end(); it++) {
-        Object &object = it->second;
-        auto renderer = object.component<Renderer>();
-        if (renderer) {
-            renderer->get().draw(&object, &cam, ctx->time);
-        }
-    }
-}
 
-void Update(GameState *ctx, float dt)
+// Seconds since startup from the high resolution counter, the clock of
+// GameState::time and of input timestamps
+static double Seconds()
 {
-    glm::vec3 &movement = ctx->controller.movement;
-    glm::vec2 &look = ctx->controller.look;
-
-    std::optional<Input> input;
-    while ((input = ctx->input_buf.pop())) {
-        switch (input->type) {
-        case InputType::Reset:
-            movement *= 0;
-            look *= 0;
-            break;
-        case InputType::Key: {
-            int digital_press_vector = input->digital.press - !input->digital.press;
-        
-            switch (input->digital.source) {
-            case SDL_SCANCODE_W:            movement.z -= digital_press_vector; break;
-            case SDL_SCANCODE_S:            movement.z += digital_press_vector; break;
-            case SDL_SCANCODE_A:            movement.x -= digital_press_vector; break;
-            case SDL_SCANCODE_D:            movement.x += digital_press_vector; break;
-            case SDL_SCANCODE_SPACE:        movement.y += digital_press_vector; break;
-            case SDL_SCANCODE_LSHIFT:       movement.y -= digital_press_vector; break;
-            case SDL_SCANCODE_UP:           look.y += digital_press_vector; break;
-            case SDL_SCANCODE_DOWN:         look.y -= digital_press_vector; break;
-            case SDL_SCANCODE_LEFT:         look.x -= digital_press_vector; break;
-            case SDL_SCANCODE_RIGHT:        look.x += digital_press_vector; break;
-            }
-            break;
-        }
-        default:
-            break;
-        }
-    }
-
-    for (auto it = ctx->objects.begin(); it != ctx->objects.end();) {
-        Object &object = it->second;
-        if (object.deleted) {
-            it = ctx->objects.erase(it);
-            continue;
-        }
-
-        object.update(ctx, dt);
-        it++;
-    }
+    static Uint64 start = SDL_GetPerformanceCounter();
+    return (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
 }
 
 void QuitLoop(GameState *ctx)
@@ -104,86 +66,300 @@ void QuitLoop(GameState *ctx)
 #endif
 }
 
-void MainLoop(GameState *ctx)
+// The UI is not rasterized in software mode, only the scene is shown
+static void PresentSoftware(GameState *ctx)
 {
-    SDL_Event ev;
-    while (SDL_PollEvent(&ev)) {
-        ImGui_ImplSDL2_ProcessEvent(&ev);
+    SoftRasterizer *raster = ctx->soft_raster;
+    SDL_Surface *window_surface = SDL_GetWindowSurface(ctx->window);
+    if (!window_surface)
+        return;
+
+    SDL_Surface *frame = SDL_CreateRGBSurfaceWithFormatFrom(&raster->color[0],
+        raster->width, raster->height, 32, raster->width * 4, SDL_PIXELFORMAT_RGBA32);
+    if (!frame)
+        return;
+
+    // Upscales when the ResolutionScaler shrank the scene
+    SDL_BlitScaled(frame, nullptr, window_surface, nullptr);
+    SDL_FreeSurface(frame);
+    SDL_UpdateWindowSurface(ctx->window);
+}
 
-        switch (ev.type) {
-        case SDL_QUIT:
-            QuitLoop(ctx);
+// Frames to keep drawing after an event so ImGui can settle hover and
+// activation state
+#define REDRAW_FRAMES_ON_EVENT 3
+// Upper bound on how long an idle loop sleeps, so a focused text field
+// still gets its cursor blink drawn
+#define IDLE_WAIT_MS 500
+
+void HandleEvent(GameState *ctx, SDL_Event *ev)
+{
+    ImGui_ImplSDL2_ProcessEvent(ev);
+
+    switch (ev->type) {
+    case SDL_QUIT:
+        QuitLoop(ctx);
+        break;
+    case SDL_KEYDOWN:
+    case SDL_KEYUP: {
+        if (ctx->imgui_io->WantCaptureKeyboard)
+            break;
+        if (ev->key.repeat)
             break;
-        case SDL_KEYDOWN:
-        case SDL_KEYUP: {
-            if (ctx->imgui_io->WantCaptureKeyboard)
-                break;
-            if (ev.key.repeat)
-                break;
 
+        Input input;
+        input.type = InputType::Key;
+        input.time = Seconds();
+        input.digital = {
+            ev->key.keysym.scancode,
+            ev->key.state == SDL_PRESSED,
+        };
+        ctx->input_buf.push(input);
+        break;
+    }
+    case SDL_WINDOWEVENT: {
+        switch (ev->window.event) {
+        case SDL_WINDOWEVENT_FOCUS_LOST: {
             Input input;
-            input.type = InputType::Key;
-            input.digital = {
-                ev.key.keysym.scancode,
-                ev.key.state == SDL_PRESSED,
-            };
+            input.type = InputType::Reset;
+            input.time = Seconds();
             ctx->input_buf.push(input);
             break;
         }
-        case SDL_WINDOWEVENT: {
-            switch (ev.window.event) {
-            case SDL_WINDOWEVENT_FOCUS_LOST: {
-                Input input;
-                input.type = InputType::Reset;
-                ctx->input_buf.push(input);
-                break;
-            }
-            default: {
-                int window_w, window_h;
-                SDL_GetWindowSize(ctx->window, &window_w, &window_h);
-                glViewport(0, 0, window_w, window_h);
-
-                Object &cam_obj = ctx->objects.at(ctx->main_camera.value());
-                CameraEditor &cam_editor = cam_obj.component<CameraEditor>().value();
-                CameraParams &cparams = cam_editor.camera_params;
-                Camera &cam = cam_obj.component<Camera>().value();
-
-                cparams.aspect = (float)window_w / (float)window_h;
-                cam.set_params(cparams);
-                break;
-            }
-            }
+        default: {
+            int window_w, window_h;
+            SDL_GetWindowSize(ctx->window, &window_w, &window_h);
+            ctx->view_w = window_w;
+            ctx->view_h = window_h;
+
+            Object &cam_obj = ctx->objects.at(ctx->main_camera.value());
+            CameraEditor &cam_editor = cam_obj.component<CameraEditor>().value();
+            CameraParams &cparams = cam_editor.camera_params;
+            Camera &cam = cam_obj.component<Camera>().value();
+
+            cparams.aspect = (float)window_w / (float)window_h;
+            cam.set_params(cparams);
+            break;
         }
-
-        default: break;
         }
     }
 
-    ImGui_ImplOpenGL3_NewFrame();
-    ImGui_ImplSDL2_NewFrame(ctx->window);
-    ImGui::NewFrame();
+    default: break;
+    }
+
+    ctx->request_redraw(REDRAW_FRAMES_ON_EVENT);
+}
+
+void MainLoop(GameState *ctx)
+{
+    SDL_Event ev;
 
-    ImGui::Begin("Configuration");
-    Update(ctx, ctx->dt);
+    if (!ctx->redraw_frames) {
+        TRACE_SCOPE("Idle");
+#ifdef __EMSCRIPTEN__
+        // The browser drives the loop, so just skip identical frames
+        while (SDL_PollEvent(&ev))
+            HandleEvent(ctx, &ev);
+        if (!ctx->redraw_frames)
+            return;
+#else
+        if (SDL_WaitEventTimeout(&ev, IDLE_WAIT_MS))
+            HandleEvent(ctx, &ev);
+        else if (ctx->imgui_io->WantTextInput)
+            ctx->request_redraw();
+        if (!ctx->redraw_frames)
+            return;
+#endif
 
-    if (ImGui::Button("Add Surface")) {
-        ctx->add_object(CreateSurface());
+        // Don't let the idle time leak into camera movement or timers
+        ctx->time = Seconds();
+        ctx->dt = 0;
     }
-    ImGui::End();
 
-    ImGui::Render();
-    DrawFrame(ctx);
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-    SDL_GL_SwapWindow(ctx->window);
+    TRACE_SCOPE("MainLoop");
+    ctx->cpu_profiler.begin_frame();
+
+    {
+        PROFILE_SCOPE(&ctx->cpu_profiler, "Events");
+        while (SDL_PollEvent(&ev)) {
+            HandleEvent(ctx, &ev);
+        }
+    }
+    ctx->redraw_frames--;
 
-    float now = SDL_GetTicks() / 1000.f;
-    ctx->dt = now - ctx->time;
+    // The frame covers time up to now, so it includes the inputs just read
+    double now = Seconds();
+    ctx->dt = (float)(now - ctx->time);
     ctx->time = now;
+
+    // A render thread draws and presents the frame on its own
+    bool threaded = ctx->render_queue.threaded();
+    if (render_backend == RenderBackend::GL && !threaded)
+        ImGui_ImplOpenGL3_NewFrame();
+    ImGui_ImplSDL2_NewFrame(ctx->window);
+    RenderFrame(ctx);
+
+    if (!threaded) {
+        {
+            PROFILE_SCOPE(&ctx->cpu_profiler, "Swap");
+            if (render_backend == RenderBackend::GL)
+                SDL_GL_SwapWindow(ctx->window);
+            else
+                PresentSoftware(ctx);
+        }
+        ctx->latency.mark(LatencyTracker::Presented);
+        ctx->latency.end_frame();
+        // Fences are only polled when a frame is drawn
+        if (ctx->latency.outstanding())
+            ctx->request_redraw();
+    }
+    ctx->cpu_profiler.end_frame();
+    FrameArena().reset();
 }
 
 
-int main(int argc, char **argv)
+struct Options {
+    bool headless = false;
+    bool software = false;
+    int width = 1600, height = 900;
+    unsigned frames = 1;
+    float frame_dt = 1.f / 60.f;
+    // A printf pattern such as `frame%04u.ppm` saves every frame, a plain
+    // path saves only the last one
+    const char *output = nullptr;
+    bool per_frame_output = false;
+    // Records from startup and writes a trace here on exit
+    const char *trace = nullptr;
+    // Session log to write, or to play back instead of taking input
+    const char *record = nullptr;
+    const char *replay = nullptr;
+    // Frames past warm-up that allocate more often are reported, and fail
+    // a headless run
+    long alloc_budget = -1;
+    // Frames between synthetic key presses and releases, 0 for none
+    unsigned synthetic_input = 0;
+    // Draw and present GL frames on their own thread, in windowed mode
+    bool render_thread = true;
+    // Megabytes of mesh data uploaded per windowed frame, 0 for no limit
+    float upload_budget = 8;
+};
+
+static void PrintUsage(const char *argv0)
+{
+    printf("Usage: %s [options]\n", argv0);
+    printf("  --headless          Render offscreen without a window (EGL)\n");
+    printf("  --software          Rasterize on the CPU instead of through OpenGL\n");
+    printf("  --size WxH          Framebuffer size (default 1600x900)\n");
+    printf("  --frames N          Number of headless frames to render (default 1)\n");
+    printf("  --dt SECONDS        Fixed headless timestep (default 1/60)\n");
+    printf("  --output PATH       Headless PPM output path or per-frame pattern\n");
+    printf("  --trace PATH        Record a Chrome trace and write it on exit\n");
+    printf("  --record PATH       Log input, frame times and UI edits for replay\n");
+    printf("  --replay PATH       Play back a logged session as fast as possible\n");
+    printf("  --alloc-budget N    Report steady-state frames making more than N allocations\n");
+    printf("  --synthetic-input N Press or release a key every N frames to measure input latency\n");
+    printf("  --no-render-thread  Draw and present on the main thread, after simulating\n");
+    printf("  --upload-budget MB  Mesh data uploaded per frame, 0 for no limit (default 8)\n");
+}
+
+// Conversions in an --output pattern, or -1 if one of them is anything but
+// the frame number's
+static int CountFrameConversions(const char *pattern)
 {
+    int count = 0;
+    for (const char *p = pattern; *p; p++) {
+        if (*p != '%')
+            continue;
+        p++;
+        if (*p == '%')
+            continue;
+        p += strspn(p, "-+ #0");
+        p += strspn(p, "0123456789");
+        if (*p == '.') {
+            p++;
+            p += strspn(p, "0123456789");
+        }
+        if (!*p || !strchr("diouxX", *p))
+            return -1;
+        count++;
+    }
+    return count;
+}
+
+static bool ParseOptions(int argc, char **argv, Options *opts)
+{
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (!strcmp(arg, "--headless")) {
+            opts->headless = true;
+        } else if (!strcmp(arg, "--software")) {
+            opts->software = true;
+        } else if (!strcmp(arg, "--size") && val) {
+            if (sscanf(val, "%dx%d", &opts->width, &opts->height) != 2)
+                return false;
+            i++;
+        } else if (!strcmp(arg, "--frames") && val) {
+            opts->frames = strtoul(val, nullptr, 10);
+            i++;
+        } else if (!strcmp(arg, "--dt") && val) {
+            opts->frame_dt = strtof(val, nullptr);
+            i++;
+        } else if (!strcmp(arg, "--output") && val) {
+            opts->output = val;
+            i++;
+        } else if (!strcmp(arg, "--trace") && val) {
+            opts->trace = val;
+            i++;
+        } else if (!strcmp(arg, "--record") && val) {
+            opts->record = val;
+            i++;
+        } else if (!strcmp(arg, "--replay") && val) {
+            opts->replay = val;
+            i++;
+        } else if (!strcmp(arg, "--alloc-budget") && val) {
+            opts->alloc_budget = strtol(val, nullptr, 10);
+            i++;
+        } else if (!strcmp(arg, "--synthetic-input") && val) {
+            opts->synthetic_input = strtoul(val, nullptr, 10);
+            i++;
+        } else if (!strcmp(arg, "--no-render-thread")) {
+            opts->render_thread = false;
+        } else if (!strcmp(arg, "--upload-budget") && val) {
+            opts->upload_budget = strtof(val, nullptr);
+            i++;
+        } else {
+            return false;
+        }
+    }
+    if (opts->record && opts->replay)
+        return false;
+    if (opts->output) {
+        // The pattern is handed to snprintf along with the frame number alone
+        int conversions = CountFrameConversions(opts->output);
+        if (conversions < 0 || conversions > 1) {
+            printf("--output takes at most one integer conversion, such as frame%%04u.ppm\n");
+            return false;
+        }
+        opts->per_frame_output = conversions == 1;
+    }
+    if (opts->alloc_budget >= 0 && !AllocTrackingEnabled()) {
+        printf("This build has no allocation tracking, configure with -DALLOC_TRACKING=ON!\n");
+        return false;
+    }
+    return opts->width > 0 && opts->height > 0 && opts->frame_dt > 0;
+}
+
+static bool OpenSession(const Options &opts, SessionLog *session)
+{
+    if (opts.record)
+        return session->record(opts.record);
+    if (opts.replay)
+        return session->load(opts.replay);
+    return true;
+}
+
 #define CHECK_RET(ret, err) do { \
         if (ret) { \
             printf(err " Retcode=%d\n", ret); \
@@ -191,13 +367,174 @@ int main(int argc, char **argv)
         } \
     } while (0)
 
-    (void)argc;
-    (void)argv;
+static int HeadlessMain(const Options &opts)
+{
+    bool gl = render_backend == RenderBackend::GL;
+
+    SessionLog session;
+    CHECK_RET(!OpenSession(opts, &session), "Failed to open the session log!");
+
+#ifdef HEADLESS_EGL
+    std::optional<HeadlessContext> egl;
+    if (gl) {
+        egl = HeadlessContext::create();
+        CHECK_RET(!egl, "Failed to create a headless GL context!");
+        printf("Renderer: %s\n", glGetString(GL_RENDERER));
+    }
+#else
+    if (gl) {
+        printf("This build has no headless GL support, use --software!\n");
+        return 1;
+    }
+#endif
+
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    DEFER({ ImGui::DestroyContext(); });
+
+    ImGuiIO& io = ImGui::GetIO();
+    io.IniFilename = nullptr;
+    io.DisplaySize = ImVec2((float)opts.width, (float)opts.height);
+    io.DeltaTime = opts.frame_dt;
+    ImGui::StyleColorsDark();
+
+    std::optional<Framebuffer> target;
+    if (gl) {
+        ImGui_ImplOpenGL3_Init("#version 300 es");
+        target.emplace(opts.width, opts.height);
+    } else {
+        unsigned char *pixels;
+        int font_w, font_h;
+        io.Fonts->GetTexDataAsRGBA32(&pixels, &font_w, &font_h);
+    }
+    DEFER({
+        if (gl)
+            ImGui_ImplOpenGL3_Shutdown();
+    });
+
+    SoftRasterizer soft_raster(&ThreadPool::shared());
+
+    GameState game_state;
+    game_state.soft_raster = &soft_raster;
+    SetupScene(&game_state, opts.width, opts.height);
+    game_state.time = 0.f;
+    game_state.dt = opts.frame_dt;
+    game_state.window = nullptr;
+    game_state.imgui_io = &io;
+    if (session.mode != SessionLog::Mode::Off)
+        game_state.session = &session;
+    game_state.cpu_profiler.alloc_budget = opts.alloc_budget;
+    game_state.latency.synthetic_period = opts.synthetic_input;
+    // Every frame has to come out the same from one run to the next, and
+    // show everything it was asked to
+    game_state.jobs.synchronous = true;
+    game_state.upload_budget = 0;
+
+    // A replay runs to its end, ignoring --frames
+    unsigned frames = opts.frames;
+    if (session.mode == SessionLog::Mode::Replay)
+        frames = session.frames.size();
+
+    bool per_frame = opts.per_frame_output;
+
+    auto save = [&](const char *path) {
+        if (gl)
+            target->save_ppm(path);
+        else
+            soft_raster.save_ppm(path);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned frame = 0; frame < frames && game_state.running; frame++) {
+        TRACE_SCOPE("MainLoop");
+        game_state.cpu_profiler.begin_frame();
+        if (gl) {
+            target->bind();
+            ImGui_ImplOpenGL3_NewFrame();
+        }
+        RenderFrame(&game_state);
+        // Offscreen, the frame counts as presented once it's submitted
+        game_state.latency.mark(LatencyTracker::Presented);
+        game_state.latency.end_frame();
+        game_state.cpu_profiler.end_frame();
+        FrameArena().reset();
+
+        if (per_frame) {
+            char path[1024];
+            if (snprintf(path, sizeof(path), opts.output, frame) >= (int)sizeof(path)) {
+                printf("Output path too long: %s\n", opts.output);
+                return 1;
+            }
+            save(path);
+        }
 
+        game_state.time += opts.frame_dt;
+    }
+    if (gl)
+        glFinish();
+    auto end = std::chrono::steady_clock::now();
+    game_state.latency.collect(true);
+
+    double total_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    printf("Rendered %u frames in %.2f ms (%.3f ms/frame)\n",
+        frames, total_ms, frames ? total_ms / frames : 0.0);
+
+    CpuProfiler &cpu_profiler = game_state.cpu_profiler;
+    printf("CPU p50 %.3f ms, p95 %.3f ms, p99 %.3f ms over the last %u frames\n",
+        cpu_profiler.p50, cpu_profiler.p95, cpu_profiler.p99,
+        std::min(cpu_profiler.frames, CpuProfiler::HISTORY));
+
+    if (game_state.latency.stages[LatencyTracker::Consumed].count)
+        game_state.latency.print();
+
+    // Everything has finished after glFinish, so this reads back the last frame
+    GpuProfiler &profiler = game_state.gpu_profiler;
+    profiler.begin_frame();
+    for (const GpuProfiler::Zone &zone : profiler.zones) {
+        printf("  GPU %-16s %.3f ms\n", zone.label.c_str(), zone.ms);
+    }
+
+    if (opts.output && !per_frame) {
+        save(opts.output);
+    }
+    if (opts.trace) {
+        TraceDump(opts.trace);
+    }
+
+    if (cpu_profiler.alloc_violations) {
+        printf("%u frames went over the allocation budget!\n", cpu_profiler.alloc_violations);
+        return 1;
+    }
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
     int ret;
 
+    Options opts;
+    if (!ParseOptions(argc, argv, &opts)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
     stbi_set_flip_vertically_on_load(true);
 
+    TraceThreadName("Main");
+    if (opts.trace)
+        TraceSetEnabled(true);
+
+    if (opts.software)
+        render_backend = RenderBackend::Software;
+    bool gl = render_backend == RenderBackend::GL;
+
+    if (opts.headless)
+        return HeadlessMain(opts);
+
+    SessionLog session;
+    CHECK_RET(!OpenSession(opts, &session), "Failed to open the session log!");
+
     int subsystems = SDL_INIT_VIDEO | SDL_INIT_EVENTS;
     ret = SDL_Init(subsystems);
     CHECK_RET(ret, "SDL Init failed!");
@@ -214,23 +551,34 @@ int main(int argc, char **argv)
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
 #endif
 
-    int win_w = 1600, win_h = 900;
-    int win_flags = SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE;
+    int win_w = opts.width, win_h = opts.height;
+    int win_flags = SDL_WINDOW_RESIZABLE | (gl ? SDL_WINDOW_OPENGL : 0);
     const char *win_title = "3yee | Parametric Equation Viewer";
     SDL_Window *window = SDL_CreateWindow(win_title, 0, 0, win_w, win_h, win_flags);
     CHECK_RET(!window, "SDL create Window failed!");
     DEFER({ SDL_DestroyWindow(window); });
 
-    SDL_GLContext glcontext = SDL_GL_CreateContext(window);
-    CHECK_RET(!glcontext, "Failed to init GL context!");
-    DEFER({ SDL_GL_DeleteContext(glcontext); });
+    SDL_GLContext glcontext = nullptr;
+    DEFER({
+        if (glcontext)
+            SDL_GL_DeleteContext(glcontext);
+    });
+
+    if (gl) {
+        glcontext = SDL_GL_CreateContext(window);
+        CHECK_RET(!glcontext, "Failed to init GL context!");
 
-    ret = SDL_GL_MakeCurrent(window, glcontext);
-    CHECK_RET(ret, "Failed to make the GL context current!");
+        ret = SDL_GL_MakeCurrent(window, glcontext);
+        CHECK_RET(ret, "Failed to make the GL context current!");
 
-    glewExperimental = GL_TRUE;
-    ret = glewInit();
-    CHECK_RET(ret != GLEW_OK, "Failed to initialize GLEW!");
+        glewExperimental = GL_TRUE;
+        ret = glewInit();
+        CHECK_RET(ret != GLEW_OK, "Failed to initialize GLEW!");
+
+        // Replays are paced by how fast frames render, not by the display
+        if (session.mode == SessionLog::Mode::Replay)
+            SDL_GL_SetSwapInterval(0);
+    }
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -242,23 +590,54 @@ int main(int argc, char **argv)
     ImGui_ImplSDL2_InitForOpenGL(window, glcontext);
     DEFER({ ImGui_ImplSDL2_Shutdown(); });
 
-    ImGui_ImplOpenGL3_Init("#version 300 es");
-    DEFER({ ImGui_ImplOpenGL3_Shutdown(); });
-
-    GameState game_state;
-    game_state.add_main_camera(CreateCamera());
-    game_state.add_object(CreateSurface());
-    game_state.add_object(CreateAxes());
+    if (gl) {
+        ImGui_ImplOpenGL3_Init("#version 300 es");
+    } else {
+        unsigned char *pixels;
+        int font_w, font_h;
+        io.Fonts->GetTexDataAsRGBA32(&pixels, &font_w, &font_h);
+    }
+    DEFER({
+        if (gl)
+            ImGui_ImplOpenGL3_Shutdown();
+    });
 
-    glEnable(GL_DEPTH_TEST);
+    SoftRasterizer soft_raster(&ThreadPool::shared());
 
-    game_state.running = true;
+    GameState game_state;
+    game_state.soft_raster = &soft_raster;
+    SetupScene(&game_state, win_w, win_h);
 
-    game_state.time = SDL_GetTicks() / 1000.f;
+    game_state.time = Seconds();
     game_state.dt = 0.f;
+    game_state.request_redraw(REDRAW_FRAMES_ON_EVENT);
 
     game_state.window = window;
     game_state.imgui_io = &io;
+    if (session.mode != SessionLog::Mode::Off)
+        game_state.session = &session;
+    game_state.cpu_profiler.alloc_budget = opts.alloc_budget;
+    game_state.latency.synthetic_period = opts.synthetic_input;
+    game_state.upload_budget = (size_t)(std::max(opts.upload_budget, 0.f) * (1 << 20));
+    // A replay has to come out the same as the headless one, so nothing
+    // may show up a frame late
+    if (session.mode == SessionLog::Mode::Replay) {
+        game_state.jobs.synchronous = true;
+        game_state.upload_budget = 0;
+    }
+
+#ifndef __EMSCRIPTEN__
+    if (gl && opts.render_thread) {
+        // Shares programs with the main context, which keeps linking them
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+        SDL_GLContext render_context = SDL_GL_CreateContext(window);
+        SDL_GL_MakeCurrent(window, glcontext);
+        if (!render_context)
+            printf("Failed to create a render context, drawing on the main thread: %s\n", SDL_GetError());
+        else
+            game_state.render_queue.start_thread(window, render_context, session.mode != SessionLog::Mode::Replay);
+    }
+#endif
 
 #ifdef __EMSCRIPTEN__
     emscripten_set_main_loop_arg((void(*)(void *))MainLoop, &game_state, 0, 1);
@@ -266,5 +645,8 @@ int main(int argc, char **argv)
     while (game_state.running) {
         MainLoop(&game_state);
     }
+
+    if (opts.trace)
+        TraceDump(opts.trace);
 #endif
 }
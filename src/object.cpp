@@ -0,0 +1,115 @@
+#include "object.h"
+
+#include <cstring>
+
+#include "game.h"
+
+// GCC and Clang spell the type out as `[with T = Name]` or `[T = Name]`,
+// MSVC as `ComponentPool<struct Name>::ComponentPool(void)`
+static std::string TypeNameFromSignature(const char *signature)
+{
+    std::string sig = signature;
+    size_t start = sig.find("T = ");
+    if (start != std::string::npos) {
+        start += 4;
+        return sig.substr(start, sig.find_first_of(";]", start) - start);
+    }
+
+    start = sig.find('<');
+    size_t end = sig.rfind(">::");
+    if (start == std::string::npos || end == std::string::npos)
+        return sig;
+    std::string name = sig.substr(start + 1, end - start - 1);
+    for (const char *prefix : { "struct ", "class " }) {
+        if (!name.compare(0, strlen(prefix), prefix))
+            name.erase(0, strlen(prefix));
+    }
+    return name;
+}
+
+ComponentPoolBase::ComponentPoolBase(World *world, unsigned type_id, const char *signature):
+    type_id(type_id), name(TypeNameFromSignature(signature)), world(world)
+{
+}
+
+EntityId World::alloc_entity(Object *obj)
+{
+    if (free_entities.empty()) {
+        entity_objects.push_back(obj);
+        return entity_objects.size() - 1;
+    }
+
+    EntityId entity = free_entities.back();
+    free_entities.pop_back();
+    entity_objects[entity] = obj;
+    return entity;
+}
+
+void World::move_entity(EntityId entity, Object *obj)
+{
+    entity_objects[entity] = obj;
+}
+
+void World::free_entity(EntityId entity)
+{
+    entity_objects[entity] = nullptr;
+    free_entities.push_back(entity);
+}
+
+Object::Object(Object &&other) noexcept:
+    world(other.world)
+{
+    *this = std::move(other);
+}
+
+Object &Object::operator=(Object &&other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    clear();
+    world = other.world;
+    entity = other.entity;
+    component_mask = other.component_mask;
+    memcpy(slots, other.slots, sizeof(slots));
+    pools = std::move(other.pools);
+    updating = other.updating;
+    deleted = other.deleted;
+
+    other.entity = NO_ENTITY;
+    other.component_mask = 0;
+    other.pools.clear();
+    if (entity != NO_ENTITY)
+        world->move_entity(entity, this);
+    return *this;
+}
+
+Object::~Object()
+{
+    clear();
+}
+
+void Object::clear()
+{
+    if (entity == NO_ENTITY)
+        return;
+
+    for (ComponentPoolBase *pool : pools)
+        pool->remove(slots[pool->type_id]);
+    pools.clear();
+    component_mask = 0;
+
+    world->free_entity(entity);
+    entity = NO_ENTITY;
+}
+
+void Object::update(GameState *ctx, float dt)
+{
+    updating = true;
+    for (ComponentPoolBase *pool : pools) {
+        Component &c = *pool->at(slots[pool->type_id]);
+        PROFILE_SCOPE(&ctx->cpu_profiler, pool->name.c_str());
+        c.update(ctx, this, dt);
+    }
+    updating = false;
+}
@@ -1,40 +1,92 @@
 #pragma once
 
-#include <unordered_map>
-#include <typeinfo>
-#include <typeindex>
-#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
-#include "resource.h"
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include "optref.h"
 
-static std::atomic_size_t uuid_gen = 0x1000;
+struct Object;
+struct GameState;
 
-// Odd by construction so coprime to 1<<32
-constexpr size_t uuid_inc = ((size_t)(-1) / 3 + (size_t)(-1) / 7) | 1;
+struct CameraEditor;
+struct Camera;
+struct Mesh;
+struct Renderer;
+struct SeparableLut;
+struct SurfaceEditor;
+struct ResolutionScaler;
 
-typedef uint64_t UuidRef;
+// Bits in Object::component_mask, raise along with its type when more
+// component types show up
+#define MAX_COMPONENT_TYPES 32
 
-struct Uuid {
-    RESOURCE_IMPL(Uuid);
-    UuidRef val;
+template <typename... T>
+struct ComponentTypeList {
+    static constexpr unsigned count = sizeof...(T);
 
-    Uuid():
-        val(uuid_gen.fetch_add(uuid_inc))
+    // `count` for types not in the list
+    template <typename U>
+    static constexpr unsigned index()
     {
+        unsigned i = 0, found = count;
+        ((std::is_same_v<U, T> ? found = i : 0, i++), ...);
+        return found;
     }
+};
+
+// Every component type, whose place in the list is its type ID. IDs index
+// Object::slots and World's pools, and are the same in every World.
+typedef ComponentTypeList<CameraEditor, Camera, Mesh, Renderer, SeparableLut, SurfaceEditor, ResolutionScaler>
+    ComponentTypes;
+
+constexpr unsigned COMPONENT_TYPE_COUNT = ComponentTypes::count;
+static_assert(COMPONENT_TYPE_COUNT <= MAX_COMPONENT_TYPES, "Too many component types, raise MAX_COMPONENT_TYPES");
+
+template <typename T>
+constexpr unsigned ComponentTypeId()
+{
+    constexpr unsigned id = ComponentTypes::index<T>();
+    static_assert(id < COMPONENT_TYPE_COUNT, "Component types have to be listed in ComponentTypes");
+    return id;
+}
 
-    operator UuidRef()
+#ifdef _MSC_VER
+#define COMPONENT_SIGNATURE __FUNCSIG__
+#else
+#define COMPONENT_SIGNATURE __PRETTY_FUNCTION__
+#endif
+
+// Component types a compute pass touches besides its own, as masks of pool
+// type IDs. Passes run side by side unless one writes what the other uses.
+struct ComponentAccess {
+    uint32_t reads = 0, writes = 0;
+
+    template <typename... T>
+    ComponentAccess &read()
     {
-        return val;
+        reads |= ((1u << ComponentTypeId<T>()) | ... | 0);
+        return *this;
     }
-};
 
-struct Object;
-struct GameState;
+    template <typename... T>
+    ComponentAccess &write()
+    {
+        writes |= ((1u << ComponentTypeId<T>()) | ... | 0);
+        return *this;
+    }
+
+    bool conflicts(const ComponentAccess &other) const
+    {
+        return (writes & (other.reads | other.writes)) || (other.writes & reads);
+    }
+};
 
 struct Component {
+    // Main thread only, and the only phase that may call ImGui or GL
     virtual void update(GameState *ctx, Object *obj, float dt)
     {
         (void)ctx;
@@ -42,47 +94,236 @@ struct Component {
         (void)dt;
     }
 
+    // Runs on pool threads once every update of the frame is done, across
+    // all objects at once. May only touch this component, the ones named
+    // by compute_access() and read-only state in ctx.
+    virtual void compute(const GameState *ctx, Object *obj, float dt)
+    {
+        (void)ctx;
+        (void)obj;
+        (void)dt;
+    }
+
+    // Types without a compute pass return nothing
+    virtual std::optional<ComponentAccess> compute_access() const
+    {
+        return {};
+    }
+
     virtual ~Component()
     {
     }
 };
 
+typedef uint32_t EntityId;
+constexpr EntityId NO_ENTITY = (EntityId)-1;
+
+struct World;
+
+// Lets an Object reach the storage of each component type it has
+struct ComponentPoolBase {
+    unsigned type_id;
+    // Readable type name for profiling, cut out of the compiler's function
+    // signature so nothing needs RTTI
+    std::string name;
+    // Whose entities own the components
+    World *world;
+
+    ComponentPoolBase(World *world, unsigned type_id, const char *signature);
+
+    virtual Component *at(uint32_t slot) = 0;
+    virtual void remove(uint32_t slot) = 0;
+    virtual size_t size() const = 0;
+
+    // Access of the type's compute pass, including a write of itself
+    virtual std::optional<ComponentAccess> compute_access() const = 0;
+    virtual void compute(const GameState *ctx, uint32_t slot, float dt) = 0;
+
+    virtual ~ComponentPoolBase()
+    {
+    }
+};
+
+// Every live component of type T, packed into one array so iterating a
+// type walks contiguous memory. Removal swaps the last slot into the hole,
+// so a reference into the pool only lasts until the next add or remove of
+// a T.
+template <typename T>
+struct ComponentPool final : ComponentPoolBase {
+    std::vector<T> dense;
+    // Owner of each slot in `dense`
+    std::vector<EntityId> entities;
+
+    ComponentPool(World *world):
+        ComponentPoolBase(world, ComponentTypeId<T>(), COMPONENT_SIGNATURE)
+    {
+    }
+
+    Component *at(uint32_t slot) override
+    {
+        return &dense[slot];
+    }
+
+    uint32_t insert(EntityId entity, T comp)
+    {
+        dense.push_back(std::move(comp));
+        entities.push_back(entity);
+        return dense.size() - 1;
+    }
+
+    void remove(uint32_t slot) override;
+
+    size_t size() const override
+    {
+        return dense.size();
+    }
+
+    std::optional<ComponentAccess> compute_access() const override
+    {
+        if (dense.empty())
+            return {};
+        auto access = dense[0].compute_access();
+        if (access)
+            access->writes |= 1u << type_id;
+        return access;
+    }
+
+    void compute(const GameState *ctx, uint32_t slot, float dt) override;
+};
+
+// The component pools of one scene, and the table from its entities to the
+// Objects owning them. Has to outlive its Objects.
+struct World {
+    World() = default;
+    World(const World &) = delete;
+    World &operator=(const World &) = delete;
+
+    // Made the first time an object in this world gets a T
+    template <typename T>
+    ComponentPool<T> &pool()
+    {
+        std::unique_ptr<ComponentPoolBase> &pool = pools[ComponentTypeId<T>()];
+        if (!pool)
+            pool = std::make_unique<ComponentPool<T>>(this);
+        return static_cast<ComponentPool<T> &>(*pool);
+    }
+
+    // Null until an object in this world has that type
+    ComponentPoolBase *pool_by_id(unsigned type_id)
+    {
+        return pools[type_id].get();
+    }
+
+    // Owner of an entity, kept current as Objects move
+    Object *object(EntityId entity)
+    {
+        return entity_objects[entity];
+    }
+
+    EntityId alloc_entity(Object *obj);
+    void move_entity(EntityId entity, Object *obj);
+    void free_entity(EntityId entity);
+
+private:
+    std::unique_ptr<ComponentPoolBase> pools[COMPONENT_TYPE_COUNT];
+    // Indexed by entity, entities of destroyed objects are reused
+    std::vector<Object *> entity_objects;
+    std::vector<EntityId> free_entities;
+};
+
+// Components live in their world's pools, an Object only owns an entity ID
+// and where to find each of its components
 struct Object final {
-    Uuid uuid;
-    std::unordered_map<std::type_index, std::unique_ptr<Component>> components;
-    bool updating;
+    World *world;
+    EntityId entity = NO_ENTITY;
+    // Bit n is set when the object has the component type with type_id n,
+    // whose slot in its pool is then slots[n]
+    uint32_t component_mask = 0;
+    uint32_t slots[MAX_COMPONENT_TYPES];
+    // In the order the components were added, which is also update order
+    std::vector<ComponentPoolBase *> pools;
+    bool updating = false;
     bool deleted = false;
 
+    explicit Object(World *world):
+        world(world)
+    {
+    }
+    Object(Object &&other) noexcept;
+    Object &operator=(Object &&other) noexcept;
+    Object(const Object &other) = delete;
+    ~Object();
+
+    template <typename T>
+    bool has_component()
+    {
+        return component_mask & (1u << ComponentTypeId<T>());
+    }
+
     template <typename T>
     optref<T> component()
     {
-        auto search = components.find(typeid(T));
-        if (search == components.end()) {
+        unsigned type_id = ComponentTypeId<T>();
+        if (!(component_mask & (1u << type_id))) {
             return {};
         }
-        T *t = static_cast<T*>(search->second.get());
-        T &ref_t = *t;
+        T &ref_t = world->pool<T>().dense[slots[type_id]];
         return ref_t;
     }
 
     template <typename T>
     bool add_component(T comp)
     {
-        std::type_index key(typeid(comp));
-        T *t = new T(std::move(comp));
-        Component *comp_ptr = static_cast<Component *>(t);
-        std::unique_ptr<Component> comp_unique(comp_ptr);
-        auto insert_ret = components.insert({ key, std::move(comp_unique) });
-        return insert_ret.second;
-    }
+        ComponentPool<T> &pool = world->pool<T>();
+        if (component_mask & (1u << pool.type_id))
+            return false;
+        if (entity == NO_ENTITY)
+            entity = world->alloc_entity(this);
 
-    void update(GameState *ctx, float dt)
-    {
-        updating = true;
-        for (auto it = components.begin(); it != components.end(); it++) {
-            Component &c = *it->second;
-            c.update(ctx, this, dt);
-        }
-        updating = false;
+        slots[pool.type_id] = pool.insert(entity, std::move(comp));
+        component_mask |= 1u << pool.type_id;
+        pools.push_back(&pool);
+        return true;
     }
+
+    void update(GameState *ctx, float dt);
+
+private:
+    // Drops every component and gives up the entity
+    void clear();
 };
+
+template <typename T>
+void ComponentPool<T>::remove(uint32_t slot)
+{
+    uint32_t last = dense.size() - 1;
+    if (slot != last) {
+        std::swap(dense[slot], dense[last]);
+        entities[slot] = entities[last];
+        world->object(entities[slot])->slots[type_id] = slot;
+    }
+    dense.pop_back();
+    entities.pop_back();
+}
+
+template <typename T>
+void ComponentPool<T>::compute(const GameState *ctx, uint32_t slot, float dt)
+{
+    Object *obj = world->object(entities[slot]);
+    if (!obj->deleted)
+        dense[slot].compute(ctx, obj, dt);
+}
+
+// Calls f(Object &, T &, Rest &...) for every object that has all of the
+// given components, in the storage order of T. List the rarest type first.
+template <typename T, typename... Rest, typename F>
+void ForEachComponent(World *world, F f)
+{
+    ComponentPool<T> &pool = world->pool<T>();
+    for (size_t i = 0; i < pool.dense.size(); i++) {
+        Object &obj = *world->object(pool.entities[i]);
+        if (!(obj.has_component<Rest>() && ...))
+            continue;
+        f(obj, pool.dense[i], obj.component<Rest>()->get()...);
+    }
+}
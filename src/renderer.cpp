@@ -1,67 +1,249 @@
 #include "renderer.h"
 
+#include <atomic>
+#include <mutex>
+
 #include <GL/glew.h>
 
-VertArrayObj::VertArrayObj()
+#include "game.h"
+#include "separable.h"
+#include "threadpool.h"
+#include "trace.h"
+
+RenderBackend render_backend = RenderBackend::GL;
+
+#define VA_OFFSETOF(type, mem) ( &((type *)NULL)->mem )
+
+#define VTX_POS_ARG 0
+#define VTX_TEXPOS_ARG 1
+
+VertArrayObj::VertArrayObj(VertArrayObj &&other) noexcept
 {
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
-    glGenVertexArrays(1, &vao);
+    *this = std::move(other);
+}
+
+VertArrayObj &VertArrayObj::operator=(VertArrayObj &&other) noexcept
+{
+    if (this != &other) {
+        std::swap(vao, other.vao);
+        std::swap(vbo, other.vbo);
+        std::swap(ebo, other.ebo);
+        std::swap(index_count, other.index_count);
+    }
+    return *this;
 }
 
 VertArrayObj::~VertArrayObj()
 {
-    if (!valid)
+    // Only left if nobody released them, which can't wait on a fence now
+    if (vbo.id)
+        glDeleteBuffers(1, &vbo.id);
+    if (ebo.id)
+        glDeleteBuffers(1, &ebo.id);
+    if (vao)
+        glDeleteVertexArrays(1, &vao);
+}
+
+void VertArrayObj::reserve(GpuBufferPool *pool, size_t vertex_bytes, size_t index_bytes)
+{
+    if (!vao)
+        glGenVertexArrays(1, &vao);
+
+    bool rebind = false;
+    if (!vbo.id || vbo.capacity < vertex_bytes) {
+        pool->release(&vbo);
+        vbo = pool->acquire(BufferKind::Vertex, vertex_bytes);
+        rebind = true;
+    }
+    if (!ebo.id || ebo.capacity < index_bytes) {
+        pool->release(&ebo);
+        ebo = pool->acquire(BufferKind::Index, index_bytes);
+        rebind = true;
+    }
+    if (!rebind)
         return;
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &ebo);
-    glDeleteVertexArrays(1, &vao);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo.id);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo.id);
+
+    glVertexAttribPointer(VTX_POS_ARG, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), VA_OFFSETOF(Vertex, x));
+    glEnableVertexAttribArray(VTX_POS_ARG);
+
+    glVertexAttribPointer(VTX_TEXPOS_ARG, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), VA_OFFSETOF(Vertex, tex_u));
+    glEnableVertexAttribArray(VTX_TEXPOS_ARG);
+
+    glBindVertexArray(0);
 }
 
+void VertArrayObj::release(GpuBufferPool *pool)
+{
+    pool->release(&vbo);
+    pool->release(&ebo);
+    index_count = 0;
+}
 
+void VertArrayObj::write_vertices(size_t offset, const void *data, size_t bytes)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, vbo.id);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, data);
+}
 
-void Renderer::draw(Object *obj, Camera *camera, float time)
+void VertArrayObj::write_indices(size_t offset, const void *data, size_t bytes)
 {
-#define VA_OFFSETOF(type, mem) ( &((type *)NULL)->mem )
+    // Binding GL_ELEMENT_ARRAY_BUFFER would change whichever VAO is bound
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ebo.id);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, data);
+}
 
-#define VTX_POS_ARG 0
-#define VTX_TEXPOS_ARG 1
+void VertArrayObj::draw()
+{
+    if (!vao)
+        return;
+    glBindVertexArray(vao);
+    glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+}
 
-    glUseProgram(shader.id);
 
-    GLint u_time = glGetUniformLocation(shader.id, "u_time");
-    // GLint u_texture = glGetUniformLocation(shader, "u_texture");
-    GLint u_model = glGetUniformLocation(shader.id, "u_model");
-    GLint u_view = glGetUniformLocation(shader.id, "u_view");
-    GLint u_proj = glGetUniformLocation(shader.id, "u_proj");
-    glUniform1f(u_time, time);
 
-    Mesh &mesh = obj->component<Mesh>().value();
-    glUniformMatrix4fv(u_model, 1, GL_FALSE, glm::value_ptr(mesh.xform));
-    auto &vertices = mesh.vertices;
-    auto &indices = mesh.indices;
-    auto &vao = mesh.vao;
+static std::atomic<uint64_t> next_key { 1 };
+static std::mutex released_keys_lock;
+static std::vector<uint64_t> released_keys;
+
+RenderKey::RenderKey(RenderKey &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+RenderKey &RenderKey::operator=(RenderKey &&other) noexcept
+{
+    if (this != &other) {
+        std::swap(id, other.id);
+    }
+    return *this;
+}
+
+RenderKey::~RenderKey()
+{
+    if (!id)
+        return;
+    std::lock_guard<std::mutex> guard(released_keys_lock);
+    released_keys.push_back(id);
+}
+
+void RenderKey::assign()
+{
+    if (!id)
+        id = next_key++;
+}
+
+void TakeReleasedKeys(std::vector<uint64_t> *out)
+{
+    std::lock_guard<std::mutex> guard(released_keys_lock);
+    out->insert(out->end(), released_keys.begin(), released_keys.end());
+    released_keys.clear();
+}
 
-    glUniformMatrix4fv(u_view, 1, GL_FALSE, glm::value_ptr(camera->xform()));
-    glUniformMatrix4fv(u_proj, 1, GL_FALSE, glm::value_ptr(camera->projection));
 
-    glBindVertexArray(vao.vao);
-    if (vao.dirty) {
-        glBindBuffer(GL_ARRAY_BUFFER, vao.vbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vao.ebo);
 
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(VIndices), &indices[0], GL_STATIC_DRAW);
-        
-        glVertexAttribPointer(VTX_POS_ARG, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), VA_OFFSETOF(Vertex, x));
-        glEnableVertexAttribArray(VTX_POS_ARG);
+bool Renderer::snapshot(GameState *ctx, Object *obj, DrawItem *item)
+{
+    TRACE_SCOPE("Renderer::snapshot");
+    if (!shader)
+        return false;
 
-        glVertexAttribPointer(VTX_TEXPOS_ARG, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), VA_OFFSETOF(Vertex, tex_u));
-        glEnableVertexAttribArray(VTX_TEXPOS_ARG);
+    // Nothing has been uploaded under a new key yet
+    bool fresh = !key.id;
+    key.assign();
 
-        vao.dirty = false;
+    Mesh &mesh = obj->component<Mesh>().value();
+    item->key = key.id;
+    item->program = shader->id;
+    item->label = label;
+    item->model = mesh.xform;
+
+    item->upload_mesh = mesh.dirty || fresh;
+    item->vertex_ranges.clear();
+    if (item->upload_mesh) {
+        item->vertices = mesh.vertices;
+        item->indices = mesh.indices;
+        mesh.dirty = false;
+    } else if (!mesh.dirty_ranges.empty()) {
+        item->vertices.clear();
+        for (const MeshRange &range : mesh.dirty_ranges) {
+            const Vertex *first = &mesh.vertices[range.first];
+            item->vertices.insert(item->vertices.end(), first, first + range.count);
+        }
+        item->vertex_ranges = mesh.dirty_ranges;
+    }
+    mesh.dirty_ranges.clear();
+
+    auto lut = obj->component<SeparableLut>();
+    item->lut = lut && lut->get().plan.active();
+    item->upload_lut = false;
+    if (item->lut) {
+        SeparableLut &table = lut->get();
+        table.prepare(ctx->time);
+        item->upload_lut = table.dirty || fresh;
+        if (item->upload_lut) {
+            item->lut_data = table.data;
+            table.dirty = false;
+        }
+        item->lut_width = table.width;
+        item->lut_rows = table.plan.rows.size();
+        item->lut_grid = table.grid;
     }
+    return true;
+}
 
-    glDrawElements(GL_TRIANGLES, indices.size() * sizeof(VIndices) / sizeof(float), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-}
\ No newline at end of file
+void Renderer::draw(GameState *ctx, Object *obj, Camera *camera)
+{
+    TRACE_SCOPE("Renderer::draw");
+    SoftRasterizer *raster = ctx->soft_raster;
+    float time = ctx->time;
+
+    Mesh &mesh = obj->component<Mesh>().value();
+    auto &vertices = mesh.vertices;
+    size_t count = vertices.size();
+
+    // Shading is the expensive part, so keep it until the mesh or the
+    // time it depends on changes
+    auto shade = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const Vertex &in = vertices[i];
+            if (soft_shader) {
+                soft_shader(in, time, &soft_pos[i], &soft_color[i]);
+            } else {
+                soft_pos[i] = glm::vec3(in.x, in.y, in.z);
+                soft_color[i] = glm::vec3(0.2f, 0.2f, 0.2f);
+            }
+        }
+    };
+    if (mesh.dirty || soft_pos.size() != count || (soft_animated && time != soft_time)) {
+        soft_pos.resize(count);
+        soft_color.resize(count);
+        raster->pool->parallel_for(count, 1024, shade);
+
+        mesh.dirty = false;
+        soft_time = time;
+    } else {
+        for (const MeshRange &range : mesh.dirty_ranges) {
+            raster->pool->parallel_for(range.count, 1024, [&](size_t begin, size_t end) {
+                shade(range.first + begin, range.first + end);
+            });
+        }
+    }
+    mesh.dirty_ranges.clear();
+
+    glm::mat4 mvp = camera->projection * camera->xform() * mesh.xform;
+    soft_verts.resize(count);
+    raster->pool->parallel_for(count, 4096, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            soft_verts[i].clip = mvp * glm::vec4(soft_pos[i], 1.f);
+            soft_verts[i].color = soft_color[i];
+        }
+    });
+
+    raster->submit(soft_verts, mesh.indices);
+}
@@ -1,11 +1,25 @@
 #pragma once
 
+#include <cstdint>
+#include <optional>
+#include <string>
 #include <vector>
 
 #include "glm.h"
+#include "bufferpool.h"
 #include "camera.h"
 #include "object.h"
+#include "separable.h"
 #include "shader.h"
+#include "softraster.h"
+
+enum class RenderBackend {
+    GL,
+    Software,
+};
+
+// Picked once at startup, before any objects are created
+extern RenderBackend render_backend;
 
 
 #pragma pack(push, 1)
@@ -18,27 +32,49 @@ struct VIndices {
 };
 #pragma pack(pop)
 
-struct VertArrayObj {
-    unsigned vbo, ebo, vao;
-    bool dirty = true;
+// Vertices [first, first + count) of a mesh
+struct MeshRange {
+    size_t first, count;
+};
 
-    RESOURCE_IMPL(VertArrayObj);
+// A mesh's vertex array, with buffers from a GpuBufferPool. Owned by
+// whichever thread draws snapshots.
+struct VertArrayObj {
+    unsigned vao = 0;
+    GpuBuffer vbo, ebo;
+    size_t index_count = 0;
 
-    VertArrayObj();
+    VertArrayObj()
+    {
+    }
+    VertArrayObj(VertArrayObj &&other) noexcept;
+    VertArrayObj &operator=(VertArrayObj &&other) noexcept;
     ~VertArrayObj();
+
+    // Makes room for a mesh, keeping the current buffers if it fits
+    void reserve(GpuBufferPool *pool, size_t vertex_bytes, size_t index_bytes);
+    // Hands the buffers back, the vertex array stays
+    void release(GpuBufferPool *pool);
+    void write_vertices(size_t offset, const void *data, size_t bytes);
+    void write_indices(size_t offset, const void *data, size_t bytes);
+
+    void draw();
 };
 
 
 struct Mesh: public Component {
-    VertArrayObj vao;
-
     glm::mat4 xform = glm::identity<glm::mat4>();
 
     std::vector<Vertex> vertices;
     std::vector<VIndices> indices;
+    // Changed since it was last uploaded or shaded
+    bool dirty = true;
+    // When it isn't, vertices that changed since without the mesh being
+    // resized, so only they need sending again
+    std::vector<MeshRange> dirty_ranges;
 
     Mesh(std::vector<Vertex> vertices, std::vector<VIndices> indices):
-        vertices(vertices), indices(indices)
+        vertices(std::move(vertices)), indices(std::move(indices))
     {
     }
 
@@ -46,17 +82,76 @@ struct Mesh: public Component {
     {
         this->vertices = vertices;
         this->indices = indices;
-        vao.dirty = true;
+        dirty = true;
+    }
+};
+
+// Names a Renderer's GL state on the render side. Assigned on the first
+// snapshot, and released along with the Renderer.
+struct RenderKey {
+    uint64_t id = 0;
+
+    RenderKey()
+    {
     }
+    RenderKey(RenderKey &&other) noexcept;
+    RenderKey &operator=(RenderKey &&other) noexcept;
+    ~RenderKey();
+
+    void assign();
+};
+
+// Keys of Renderers destroyed since the last call, whose GL state can go
+void TakeReleasedKeys(std::vector<uint64_t> *out);
+
+// One object as the GL backend draws it, copied out of its components so
+// it can be drawn while the next frame is simulated
+struct DrawItem {
+    uint64_t key;
+    unsigned program;
+    std::string label;
+    glm::mat4 model;
+
+    // The mesh, only filled in when it changed since the last snapshot
+    bool upload_mesh;
+    std::vector<Vertex> vertices;
+    std::vector<VIndices> indices;
+    // Otherwise, vertices that changed, packed one range after another in
+    // `vertices`
+    std::vector<MeshRange> vertex_ranges;
+
+    // See SeparableLut, the table is only filled in when it changed
+    bool lut;
+    bool upload_lut;
+    std::vector<float> lut_data;
+    unsigned lut_width, lut_rows;
+    SeparableGrid lut_grid;
 };
 
 struct Renderer: Component {
-    ShaderProgram shader;
+    std::optional<ShaderProgram> shader;
+    // Names this object's pass in the GPU timings
+    std::string label = "Object";
 
-    Renderer(ShaderProgram shader):
+    // Used instead of the shader by the software backend. Defaults to
+    // passing positions through in flat gray, like axes.frag.
+    SoftShader soft_shader;
+    bool soft_animated = false;
+
+    RenderKey key;
+
+    Renderer(std::optional<ShaderProgram> shader):
         shader(std::move(shader))
     {
     }
 
-    void draw(Object *obj, Camera *camera, float time);
+    // GL backend, returns false if there's nothing to draw
+    bool snapshot(GameState *ctx, Object *obj, DrawItem *item);
+    // Software backend
+    void draw(GameState *ctx, Object *obj, Camera *camera);
+
+private:
+    std::vector<glm::vec3> soft_pos, soft_color;
+    std::vector<SoftVertex> soft_verts;
+    float soft_time = 0;
 };
\ No newline at end of file
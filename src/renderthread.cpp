@@ -0,0 +1,184 @@
+#include "renderthread.h"
+
+#include <chrono>
+#include <cstdio>
+
+#include <SDL.h>
+#include <GL/glew.h>
+
+#include <imgui_impl_opengl3.h>
+
+#include "gpuprofiler.h"
+#include "shader.h"
+#include "trace.h"
+
+// How often fenced frames are polled while no snapshot comes along
+#define FENCE_POLL_MS 2
+
+RenderQueue::RenderQueue(GpuProfiler *gpu_profiler, LatencyTracker *latency):
+    renderer(gpu_profiler, latency), gpu_profiler(gpu_profiler), latency(latency)
+{
+    for (FrameSnapshot &slot : slots)
+        free_slots[free_count++] = &slot;
+}
+
+RenderQueue::~RenderQueue()
+{
+    stop_thread();
+}
+
+bool RenderQueue::start_thread(SDL_Window *window, void *context, bool vsync)
+{
+    this->context = context;
+    started = quitting = false;
+    thread = std::thread([this, window, vsync]() { run(window, vsync); });
+
+    std::unique_lock<std::mutex> guard(lock);
+    freed.wait(guard, [&]() { return started || quitting; });
+    if (quitting) {
+        guard.unlock();
+        stop_thread();
+        return false;
+    }
+
+    defer_program_deletes = true;
+    return true;
+}
+
+void RenderQueue::stop_thread()
+{
+    if (!threaded())
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quitting = true;
+    }
+    wake.notify_all();
+    thread.join();
+    SDL_GL_DeleteContext(context);
+    context = nullptr;
+
+    // Snapshots still queued are dropped, along with what they released
+    for (; queued_count; queued_count--) {
+        FrameSnapshot *snap = queued[queued_first];
+        queued_first = (queued_first + 1) % SLOTS;
+        for (unsigned program : snap->released_programs)
+            glDeleteProgram(program);
+        snap->released_programs.clear();
+        snap->released_keys.clear();
+        if (snap->ready)
+            glDeleteSync((GLsync)snap->ready);
+        snap->ready = nullptr;
+        free_slots[free_count++] = snap;
+    }
+
+    defer_program_deletes = false;
+    std::vector<unsigned> programs;
+    TakeReleasedPrograms(&programs);
+    for (unsigned program : programs)
+        glDeleteProgram(program);
+}
+
+FrameSnapshot *RenderQueue::acquire()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    freed.wait(guard, [&]() { return free_count > 0; });
+    return free_slots[--free_count];
+}
+
+void RenderQueue::submit(FrameSnapshot *snap)
+{
+    if (!threaded()) {
+        renderer.draw(snap);
+        upload_backlog = renderer.upload_backlog();
+        std::lock_guard<std::mutex> guard(lock);
+        free_slots[free_count++] = snap;
+        return;
+    }
+
+    // Programs linked on this context since the last frame have to be
+    // complete before the other one uses them
+    snap->ready = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queued[(queued_first + queued_count) % SLOTS] = snap;
+        queued_count++;
+    }
+    wake.notify_one();
+}
+
+void RenderQueue::run(SDL_Window *window, bool vsync)
+{
+    TraceThreadName("Render");
+
+    bool ok = SDL_GL_MakeCurrent(window, context) == 0;
+    if (ok) {
+        if (!vsync)
+            SDL_GL_SetSwapInterval(0);
+        // Creates the font texture, which has to exist before the
+        // simulation's first ImGui::NewFrame
+        ImGui_ImplOpenGL3_NewFrame();
+    } else {
+        printf("Failed to make the render context current: %s\n", SDL_GetError());
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        started = ok;
+        quitting = !ok;
+    }
+    freed.notify_all();
+    if (!ok)
+        return;
+
+    for (;;) {
+        FrameSnapshot *snap = nullptr;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            auto ready = [&]() { return quitting || queued_count; };
+            // The last frame before the simulation goes idle still has to
+            // be seen finishing
+            if (latency->outstanding())
+                wake.wait_for(guard, std::chrono::milliseconds(FENCE_POLL_MS), ready);
+            else
+                wake.wait(guard, ready);
+            if (quitting)
+                break;
+            if (queued_count)
+                snap = queued[queued_first];
+        }
+        if (!snap) {
+            latency->collect(false);
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        renderer.draw(snap);
+        upload_backlog = renderer.upload_backlog();
+        {
+            TRACE_SCOPE("Swap");
+            SDL_GL_SwapWindow(window);
+        }
+        latency->mark(snap->inputs, LatencyTracker::Presented);
+        latency->end_frame(snap->inputs);
+        auto end = std::chrono::steady_clock::now();
+        render_ms = std::chrono::duration<float, std::milli>(end - start).count();
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            queued_first = (queued_first + 1) % SLOTS;
+            queued_count--;
+            free_slots[free_count++] = snap;
+        }
+        freed.notify_one();
+    }
+
+    renderer.release();
+    gpu_profiler->release();
+    latency->collect(true);
+    ImGui_ImplOpenGL3_DestroyDeviceObjects();
+    SDL_GL_MakeCurrent(window, nullptr);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "snapshot.h"
+
+struct SDL_Window;
+
+// Hands frame snapshots from the simulation to whatever draws them. Without
+// a render thread, submit() draws on the spot. With one, the thread owns a
+// second GL context sharing objects with the main one, and draws and
+// presents snapshots in order while the next frames are simulated. Three
+// slots let one frame be built while one waits and one is drawn.
+struct RenderQueue {
+    static constexpr unsigned SLOTS = 3;
+
+    // Milliseconds the render thread spent on its last frame, from the
+    // start of drawing until the swap returned
+    std::atomic<float> render_ms { 0 };
+    // Bytes of mesh data left to upload after the last frame drawn
+    std::atomic<size_t> upload_backlog { 0 };
+
+    RenderQueue(GpuProfiler *gpu_profiler, LatencyTracker *latency);
+    ~RenderQueue();
+
+    RenderQueue(const RenderQueue &) = delete;
+    RenderQueue &operator=(const RenderQueue &) = delete;
+
+    bool threaded() const
+    {
+        return thread.joinable();
+    }
+
+    // Stats may be read from any thread
+    const GpuBufferPool &buffer_pool() const
+    {
+        return renderer.buffer_pool();
+    }
+
+    // Takes over `context`, which must not be current anywhere, and returns
+    // once the thread is ready to draw into `window`. On failure, frames
+    // keep being drawn inline.
+    bool start_thread(SDL_Window *window, void *context, bool vsync);
+    void stop_thread();
+
+    // Blocks while every slot is in use
+    FrameSnapshot *acquire();
+    void submit(FrameSnapshot *snap);
+
+private:
+    FrameSnapshot slots[SLOTS];
+    FrameSnapshot *free_slots[SLOTS];
+    unsigned free_count = 0;
+    // Submitted and not yet drawn, oldest first
+    FrameSnapshot *queued[SLOTS];
+    unsigned queued_first = 0, queued_count = 0;
+
+    std::mutex lock;
+    std::condition_variable wake, freed;
+    bool started = false, quitting = false;
+
+    SnapshotRenderer renderer;
+    GpuProfiler *gpu_profiler;
+    LatencyTracker *latency;
+    std::thread thread;
+    void *context = nullptr;
+
+    void run(SDL_Window *window, bool vsync);
+};
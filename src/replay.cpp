@@ -0,0 +1,264 @@
+#include "replay.h"
+
+#include <cstdint>
+
+#include <imgui.h>
+
+#include "game.h"
+
+// Native byte order, logs are meant to be replayed on the machine that made them
+#define SESSION_MAGIC "3YRP"
+#define SESSION_VERSION 3
+
+#define TAG_FRAME 'F'
+#define TAG_INPUT 'I'
+#define TAG_EDIT 'E'
+
+SessionLog::~SessionLog()
+{
+    if (file)
+        fclose(file);
+}
+
+template <typename T>
+static void Write(FILE *file, T value)
+{
+    fwrite(&value, sizeof(T), 1, file);
+}
+
+bool SessionLog::record(const std::string &path)
+{
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        printf("Could not open session log at `%s` for writing!\n", path.c_str());
+        return false;
+    }
+
+    fwrite(SESSION_MAGIC, 4, 1, file);
+    Write<uint32_t>(file, SESSION_VERSION);
+    mode = Mode::Record;
+    return true;
+}
+
+struct Reader {
+    const std::vector<char> &data;
+    size_t pos = 0;
+
+    template <typename T>
+    bool read(T *value)
+    {
+        if (data.size() - pos < sizeof(T))
+            return false;
+        memcpy(value, &data[pos], sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    bool read_bytes(std::string *bytes, size_t size)
+    {
+        if (data.size() - pos < size)
+            return false;
+        bytes->assign(&data[pos], size);
+        pos += size;
+        return true;
+    }
+};
+
+bool SessionLog::load(const std::string &path)
+{
+    FILE *in = fopen(path.c_str(), "rb");
+    if (!in) {
+        printf("Could not open session log at `%s`!\n", path.c_str());
+        return false;
+    }
+
+    std::vector<char> data;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    fclose(in);
+
+    Reader reader { data };
+    uint32_t version = 0;
+    if (data.size() < 8 || memcmp(&data[0], SESSION_MAGIC, 4) != 0) {
+        printf("`%s` is not a session log!\n", path.c_str());
+        return false;
+    }
+    reader.pos = 4;
+    reader.read(&version);
+    if (version != SESSION_VERSION) {
+        printf("Session log `%s` has version %u, expected %u!\n", path.c_str(), version, SESSION_VERSION);
+        return false;
+    }
+
+    frames.clear();
+    char tag;
+    while (reader.read(&tag)) {
+        bool ok = true;
+
+        switch (tag) {
+        case TAG_FRAME: {
+            Frame frame;
+            ok = reader.read(&frame.time) && reader.read(&frame.dt);
+            frames.push_back(std::move(frame));
+            break;
+        }
+        case TAG_INPUT: {
+            uint8_t type;
+            int32_t source;
+            double time;
+            float x, y;
+            ok = !frames.empty() && reader.read(&type) && reader.read(&time) && reader.read(&source)
+                && reader.read(&x) && reader.read(&y);
+            if (!ok)
+                break;
+
+            Input input;
+            input.type = (InputType)type;
+            input.time = time;
+            switch (input.type) {
+            case InputType::Key:        input.digital = { source, x != 0 }; break;
+            case InputType::Analog1d:   input.analog1d = { source, x }; break;
+            default:                    input.analog2d = { source, glm::vec2(x, y) }; break;
+            }
+            frames.back().inputs.push_back(input);
+            break;
+        }
+        case TAG_EDIT: {
+            Edit edit;
+            uint32_t id, size;
+            ok = !frames.empty() && reader.read(&id) && reader.read(&size)
+                && reader.read_bytes(&edit.bytes, size);
+            if (!ok)
+                break;
+
+            edit.id = id;
+            frames.back().edits.push_back(std::move(edit));
+            break;
+        }
+        default:
+            ok = false;
+            break;
+        }
+
+        if (!ok) {
+            printf("Session log `%s` is corrupt at byte %zu!\n", path.c_str(), reader.pos);
+            return false;
+        }
+    }
+
+    printf("Loaded %zu frames from `%s`\n", frames.size(), path.c_str());
+    mode = Mode::Replay;
+    frame = 0;
+    return true;
+}
+
+void SessionLog::begin_frame(GameState *ctx)
+{
+    if (frame == 0)
+        start = std::chrono::steady_clock::now();
+
+    switch (mode) {
+    case Mode::Record:
+        Write<char>(file, TAG_FRAME);
+        Write<double>(file, ctx->time);
+        Write<float>(file, ctx->dt);
+        break;
+    case Mode::Replay:
+        if (frame < frames.size()) {
+            ctx->time = frames[frame].time;
+            ctx->dt = frames[frame].dt;
+        }
+        // Never idle, the next frame follows as soon as this one is done
+        ctx->request_redraw();
+        break;
+    default:
+        break;
+    }
+}
+
+void SessionLog::end_frame(GameState *ctx)
+{
+    if (mode == Mode::Off)
+        return;
+    frame++;
+
+    if (mode == Mode::Replay && frame == frames.size()) {
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("Replayed %zu frames in %.2f ms (%.3f ms/frame)\n", frame, ms, ms / frame);
+        ctx->running = false;
+    }
+}
+
+void SessionLog::sync_inputs(FrameVector<Input> *inputs)
+{
+    switch (mode) {
+    case Mode::Record:
+        for (const Input &input : *inputs) {
+            float x = 0, y = 0;
+            int32_t source = 0;
+            switch (input.type) {
+            case InputType::Key:
+                source = input.digital.source;
+                x = input.digital.press;
+                break;
+            case InputType::Analog1d:
+                source = input.analog1d.source;
+                x = input.analog1d.vel;
+                break;
+            case InputType::Analog2d:
+                source = input.analog2d.source;
+                x = input.analog2d.vel.x;
+                y = input.analog2d.vel.y;
+                break;
+            default:
+                break;
+            }
+
+            Write<char>(file, TAG_INPUT);
+            Write<uint8_t>(file, (uint8_t)input.type);
+            Write<double>(file, input.time);
+            Write<int32_t>(file, source);
+            Write<float>(file, x);
+            Write<float>(file, y);
+        }
+        break;
+    case Mode::Replay:
+        // Live input is dropped so it can't disturb the replay
+        inputs->clear();
+        if (frame < frames.size())
+            inputs->assign(frames[frame].inputs.begin(), frames[frame].inputs.end());
+        break;
+    default:
+        break;
+    }
+}
+
+bool SessionLog::sync(const char *label, std::string *value, bool changed)
+{
+    switch (mode) {
+    case Mode::Record:
+        if (changed) {
+            Write<char>(file, TAG_EDIT);
+            Write<uint32_t>(file, ImGui::GetID(label));
+            Write<uint32_t>(file, value->size());
+            fwrite(value->data(), 1, value->size(), file);
+        }
+        return changed;
+    case Mode::Replay: {
+        if (frame >= frames.size())
+            return false;
+        unsigned id = ImGui::GetID(label);
+        for (const Edit &edit : frames[frame].edits) {
+            if (edit.id == id) {
+                *value = edit.bytes;
+                return true;
+            }
+        }
+        return false;
+    }
+    default:
+        return changed;
+    }
+}
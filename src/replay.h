@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "arena.h"
+#include "input.h"
+
+struct GameState;
+
+// Records a session's frame times, controller inputs and UI edits to a
+// compact binary log, and plays one back. A replay reproduces the session
+// frame for frame, with the recorded time steps and no idling between
+// frames, so it can be rerun as an end-to-end performance test.
+//
+// UI edits are keyed by ImGui ID. Editors pass each value they let the user
+// change through sync(): while recording, changed values are logged, and
+// while replaying, the logged values overwrite them instead.
+struct SessionLog {
+    enum class Mode {
+        Off,
+        Record,
+        Replay,
+    };
+
+    struct Edit {
+        unsigned id;
+        std::string bytes;
+    };
+    struct Frame {
+        double time;
+        float dt;
+        std::vector<Input> inputs;
+        std::vector<Edit> edits;
+    };
+
+    Mode mode = Mode::Off;
+    std::vector<Frame> frames;
+    size_t frame = 0;
+
+    SessionLog() = default;
+    SessionLog(const SessionLog &other) = delete;
+    ~SessionLog();
+
+    bool record(const std::string &path);
+    bool load(const std::string &path);
+
+    // Wrap everything a frame does, from before Update to after drawing
+    void begin_frame(GameState *ctx);
+    void end_frame(GameState *ctx);
+
+    // Called by Update with the inputs it drained from the ring
+    void sync_inputs(FrameVector<Input> *inputs);
+
+    // Returns whether the value changed this frame
+    bool sync(const char *label, std::string *value, bool changed);
+
+    template <typename T>
+    bool sync_value(const char *label, T *value, bool changed)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "sync_value needs plain data");
+        std::string bytes((const char *)value, sizeof(T));
+        if (!sync(label, &bytes, changed))
+            return false;
+        if (bytes.size() == sizeof(T))
+            memcpy(value, bytes.data(), sizeof(T));
+        return true;
+    }
+
+private:
+    FILE *file = nullptr;
+    std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,142 @@
+#include "resscale.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include <imgui.h>
+
+#include "game.h"
+#include "defer.h"
+#include "renderer.h"
+
+// Frames to average before deciding anything
+#define MIN_SAMPLES 10
+// Frames to ignore after a change, while its own cost settles. A new mesh
+// takes a while to build and upload.
+#define RES_COOLDOWN 15
+#define TESS_COOLDOWN 60
+
+#define RES_STEP 0.05f
+#define TESS_STEP 0.7f
+// Overshoot tolerated before scaling down, and the headroom a step back up
+// must be predicted to leave. The gap keeps the two from fighting.
+#define OVER_BUDGET 1.05f
+#define UNDER_BUDGET 0.9f
+
+static void Smooth(float *avg, float sample, unsigned *samples)
+{
+    *avg = *samples ? *avg + 0.1f * (sample - *avg) : sample;
+    (*samples)++;
+}
+
+void ResolutionScaler::update(GameState *ctx, Object *obj, float dt)
+{
+    (void)obj; (void)dt;
+
+    ImGui::PushID("Dynamic Resolution");
+    DEFER({ ImGui::PopID(); });
+
+    if (ImGui::CollapsingHeader("Dynamic Resolution"))
+    {
+        ImGui::Checkbox("Enabled", &enabled);
+        ImGui::InputFloat("Target Frame Time (ms)", &target_ms);
+        ImGui::Checkbox("Scale Resolution", &scale_resolution);
+        ImGui::SliderFloat("Min Resolution", &min_res_scale, 0.1f, 1.f);
+        ImGui::Checkbox("Scale Tessellation", &scale_tessellation);
+        ImGui::SliderFloat("Min Tessellation", &min_tess_scale, 0.05f, 1.f);
+
+        int w, h;
+        scene_size(ctx->view_w, ctx->view_h, &w, &h);
+        ImGui::Text("CPU %.2f ms, GPU %.2f ms", cpu_ms, gpu_ms);
+        ImGui::Text("Resolution %d%% (%dx%d), tessellation %d%%",
+            (int)roundf(res_scale * 100), w, h, (int)roundf(tess_scale * 100));
+        ImGui::Text("Last change: %s", decision.c_str());
+        ImGui::PlotLines("Frame Time (ms)", history, HISTORY, history_pos % HISTORY,
+            nullptr, 0.f, target_ms * 2, ImVec2(0, 60));
+
+        ImGui::Spacing();
+    }
+
+    target_ms = std::max(target_ms, 1.f);
+
+    measure(ctx);
+
+    if (!enabled || !scale_resolution)
+        res_scale = 1.f;
+    if (!enabled || !scale_tessellation)
+        tess_scale = 1.f;
+    res_scale = std::max(res_scale, min_res_scale);
+    tess_scale = std::max(tess_scale, min_tess_scale);
+
+    if (enabled && !cooldown && cpu_samples >= MIN_SAMPLES)
+        adjust(ctx, std::max(cpu_ms, gpu_ms));
+
+    ctx->tess_scale = tess_scale;
+}
+
+void ResolutionScaler::measure(GameState *ctx)
+{
+    std::optional<float> gpu = ctx->gpu_profiler.new_total(&gpu_results);
+
+    float frame_ms = std::max(ctx->cpu_frame_ms, gpu.value_or(gpu_ms));
+    history[history_pos++ % HISTORY] = frame_ms;
+
+    if (cooldown) {
+        cooldown--;
+        return;
+    }
+
+    Smooth(&cpu_ms, ctx->cpu_frame_ms, &cpu_samples);
+    if (gpu)
+        Smooth(&gpu_ms, *gpu, &gpu_samples);
+}
+
+void ResolutionScaler::adjust(GameState *ctx, float frame_ms)
+{
+    auto change = [&](float *scale, float next, const char *what, unsigned settle) {
+        char text[128];
+        snprintf(text, sizeof(text), "%s %d%% -> %d%% at %.2f ms", what,
+            (int)roundf(*scale * 100), (int)roundf(next * 100), frame_ms);
+        printf("Dynamic resolution: %s\n", text);
+
+        decision = text;
+        *scale = next;
+        cooldown = settle;
+        cpu_samples = gpu_samples = 0;
+        ctx->request_redraw();
+    };
+
+    if (frame_ms > target_ms * OVER_BUDGET) {
+        if (scale_resolution && res_scale > min_res_scale) {
+            // Pixel cost goes with the square of the scale
+            float wanted = res_scale * sqrtf(target_ms / frame_ms);
+            float next = std::min(floorf(wanted / RES_STEP) * RES_STEP, res_scale - RES_STEP);
+            change(&res_scale, std::max(next, min_res_scale), "Resolution", RES_COOLDOWN);
+        } else if (scale_tessellation && tess_scale > min_tess_scale) {
+            float next = std::max(tess_scale * TESS_STEP, min_tess_scale);
+            change(&tess_scale, next, "Tessellation", TESS_COOLDOWN);
+        }
+        return;
+    }
+
+    // Undo the reductions in reverse, only when the step is predicted to
+    // stay well within budget
+    if (tess_scale < 1.f) {
+        float next = std::min(tess_scale / TESS_STEP, 1.f);
+        float ratio = next / tess_scale;
+        if (frame_ms * ratio * ratio < target_ms * UNDER_BUDGET)
+            change(&tess_scale, next, "Tessellation", TESS_COOLDOWN);
+    } else if (res_scale < 1.f) {
+        float next = std::min(res_scale + RES_STEP, 1.f);
+        float ratio = next / res_scale;
+        if (frame_ms * ratio * ratio < target_ms * UNDER_BUDGET)
+            change(&res_scale, next, "Resolution", RES_COOLDOWN);
+    }
+}
+
+void ResolutionScaler::scene_size(int view_w, int view_h, int *w, int *h) const
+{
+    *w = std::max(1, (int)roundf(view_w * res_scale));
+    *h = std::max(1, (int)roundf(view_h * res_scale));
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "object.h"
+
+// Holds a frame-time budget by drawing the scene into a fraction of the
+// window and upscaling it, then by coarsening surface tessellation once the
+// resolution is at its floor. Lives on the camera object.
+struct ResolutionScaler : Component {
+    static constexpr unsigned HISTORY = 120;
+
+    bool enabled = false;
+    bool scale_resolution = true;
+    bool scale_tessellation = true;
+    float target_ms = 16.6f;
+    float min_res_scale = 0.5f;
+    float min_tess_scale = 0.25f;
+
+    // Fraction of the window size, per axis
+    float res_scale = 1.f;
+    // Fraction of each surface's grid resolution, per axis
+    float tess_scale = 1.f;
+
+    // Smoothed over the frames since the last decision. GPU time covers
+    // every pass in GameState::gpu_profiler.
+    float cpu_ms = 0, gpu_ms = 0;
+    std::string decision = "None yet";
+    float history[HISTORY] = {};
+    unsigned history_pos = 0;
+
+    void update(GameState *ctx, Object *obj, float dt);
+
+    void scene_size(int view_w, int view_h, int *w, int *h) const;
+
+private:
+    unsigned long gpu_results = 0;
+    unsigned cpu_samples = 0, gpu_samples = 0;
+    unsigned cooldown = 0;
+
+    void measure(GameState *ctx);
+    void adjust(GameState *ctx, float frame_ms);
+};
@@ -0,0 +1,70 @@
+#include "scheduler.h"
+
+#include "arena.h"
+#include "game.h"
+#include "threadpool.h"
+#include "trace.h"
+
+// Below this many items a wave runs on the calling thread, since waking
+// the pool would cost more than it saves
+#define INLINE_ITEMS 4
+
+struct ComputePass {
+    ComponentPoolBase *pool;
+    ComponentAccess access;
+    // Items of the wave before this pass's first one
+    size_t first;
+};
+
+struct ComputeWave {
+    FrameVector<ComputePass> passes;
+    size_t items = 0;
+};
+
+void RunComputePasses(GameState *ctx, ThreadPool *pool, float dt)
+{
+    FrameVector<ComputeWave> waves;
+
+    for (unsigned id = 0; id < COMPONENT_TYPE_COUNT; id++) {
+        ComponentPoolBase *components = ctx->world.pool_by_id(id);
+        if (!components)
+            continue;
+        auto access = components->compute_access();
+        if (!access)
+            continue;
+
+        // After the last wave it conflicts with, so dependent passes keep
+        // their order
+        size_t wave = 0;
+        for (size_t i = 0; i < waves.size(); i++) {
+            for (const ComputePass &pass : waves[i].passes) {
+                if (pass.access.conflicts(*access))
+                    wave = i + 1;
+            }
+        }
+        if (wave == waves.size())
+            waves.emplace_back();
+
+        ComputeWave &target = waves[wave];
+        target.passes.push_back({ components, *access, target.items });
+        target.items += components->size();
+    }
+
+    for (const ComputeWave &wave : waves) {
+        auto run = [&](size_t begin, size_t end) {
+            size_t p = 0;
+            for (size_t i = begin; i < end; i++) {
+                while (i >= wave.passes[p].first + wave.passes[p].pool->size())
+                    p++;
+                const ComputePass &pass = wave.passes[p];
+                TRACE_SCOPE(pass.pool->name.c_str());
+                pass.pool->compute(ctx, i - pass.first, dt);
+            }
+        };
+
+        if (wave.items < INLINE_ITEMS)
+            run(0, wave.items);
+        else
+            pool->parallel_for(wave.items, 1, run);
+    }
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+struct GameState;
+struct ThreadPool;
+
+// Runs the compute pass of every component type over all objects that have
+// it. Passes whose access sets don't conflict are grouped into one wave and
+// share a single parallel loop; waves run in type order.
+void RunComputePasses(GameState *ctx, ThreadPool *pool, float dt);
@@ -0,0 +1,248 @@
+#include "separable.h"
+
+#include <algorithm>
+
+struct SeparableTerm {
+    bool negate;
+    ExprRef expr;
+};
+
+static void collect_terms(const ExprRef &expr, bool negate, std::vector<SeparableTerm> *terms)
+{
+    switch (expr->kind) {
+    case Expr::Kind::Add:
+        collect_terms(expr->args[0], negate, terms);
+        collect_terms(expr->args[1], negate, terms);
+        break;
+    case Expr::Kind::Sub:
+        collect_terms(expr->args[0], negate, terms);
+        collect_terms(expr->args[1], !negate, terms);
+        break;
+    case Expr::Kind::Neg:
+        collect_terms(expr->args[0], !negate, terms);
+        break;
+    default:
+        terms->push_back({ negate, expr });
+        break;
+    }
+}
+
+static ExprRef join_terms(const std::vector<SeparableTerm> &terms)
+{
+    ExprRef sum = terms[0].negate ? Expr::make_neg(terms[0].expr) : terms[0].expr;
+    for (size_t i = 1; i < terms.size(); i++) {
+        auto kind = terms[i].negate ? Expr::Kind::Sub : Expr::Kind::Add;
+        sum = Expr::make_binary(kind, sum, terms[i].expr);
+    }
+    return sum;
+}
+
+// exp(a(u) + b(v)) == exp(a(u)) * exp(b(v)), which is how most decaying
+// surfaces are written.
+static bool split_exp(const ExprRef &expr, std::vector<ExprRef> *out)
+{
+    if (expr->kind != Expr::Kind::Call || (expr->text != "exp" && expr->text != "exp2"))
+        return false;
+
+    std::vector<SeparableTerm> terms;
+    collect_terms(expr->args[0], false, &terms);
+
+    std::vector<SeparableTerm> groups[3];
+    for (auto &term : terms) {
+        unsigned axes = term.expr->deps & (DEP_U | DEP_V);
+        groups[axes == DEP_U ? 0 : axes == DEP_V ? 1 : 2].push_back(term);
+    }
+
+    size_t nonempty = !groups[0].empty() + !groups[1].empty() + !groups[2].empty();
+    if (nonempty < 2)
+        return false;
+
+    for (auto &group : groups) {
+        if (group.empty())
+            continue;
+        out->push_back(Expr::make_call(expr->text, { join_terms(group) }).value());
+    }
+    return true;
+}
+
+static void collect_factors(const ExprRef &expr, bool inverse, bool *negate,
+                            std::vector<SeparableFactor> *factors)
+{
+    switch (expr->kind) {
+    case Expr::Kind::Mul:
+        collect_factors(expr->args[0], inverse, negate, factors);
+        collect_factors(expr->args[1], inverse, negate, factors);
+        break;
+    case Expr::Kind::Div:
+        collect_factors(expr->args[0], inverse, negate, factors);
+        collect_factors(expr->args[1], !inverse, negate, factors);
+        break;
+    case Expr::Kind::Neg:
+        *negate = !*negate;
+        collect_factors(expr->args[0], inverse, negate, factors);
+        break;
+    default: {
+        std::vector<ExprRef> split;
+        if (split_exp(expr, &split)) {
+            for (auto &part : split)
+                factors->push_back({ part, inverse });
+        } else {
+            factors->push_back({ expr, inverse });
+        }
+        break;
+    }
+    }
+}
+
+// Only worth a table slot if it is expensive and reads a single axis
+static unsigned tabulated_axis(const SeparableFactor &factor)
+{
+    if (!factor.expr->has_call)
+        return DEP_NONE;
+    unsigned axes = factor.expr->deps & (DEP_U | DEP_V);
+    return axes == DEP_U || axes == DEP_V ? axes : DEP_NONE;
+}
+
+static size_t add_row(std::vector<SeparableRow> *rows, unsigned axis, std::vector<SeparableFactor> factors)
+{
+    SeparableRow row;
+    row.axis = axis;
+    row.time_dependent = false;
+    for (auto &factor : factors) {
+        row.key += factor.inverse ? "/" : "*";
+        row.key += factor.expr->glsl();
+        row.time_dependent |= (factor.expr->deps & DEP_T) != 0;
+    }
+    row.factors = std::move(factors);
+
+    for (size_t i = 0; i < rows->size(); i++) {
+        if ((*rows)[i].axis == axis && (*rows)[i].key == row.key)
+            return i;
+    }
+    rows->push_back(std::move(row));
+    return rows->size() - 1;
+}
+
+static std::string separate(const ExprRef &expr, std::vector<SeparableRow> *rows)
+{
+    std::vector<SeparableTerm> terms;
+    collect_terms(expr, false, &terms);
+
+    std::string out;
+    for (auto &term : terms) {
+        bool negate = term.negate;
+        std::vector<SeparableFactor> factors;
+        collect_factors(term.expr, false, &negate, &factors);
+
+        std::vector<SeparableFactor> axis_factors[2];
+        std::string num, den;
+        for (auto &factor : factors) {
+            unsigned axis = tabulated_axis(factor);
+            if (axis != DEP_NONE) {
+                axis_factors[axis == DEP_V].push_back(factor);
+                continue;
+            }
+            std::string &dst = factor.inverse ? den : num;
+            dst += dst.empty() ? "" : " * ";
+            dst += factor.expr->glsl();
+        }
+
+        for (unsigned a = 0; a < 2; a++) {
+            if (axis_factors[a].empty())
+                continue;
+            size_t row = add_row(rows, a ? DEP_V : DEP_U, std::move(axis_factors[a]));
+            num += num.empty() ? "" : " * ";
+            num += "lut(ij." + std::string(a ? "y" : "x") + ", " + std::to_string(row) + ")";
+        }
+
+        if (num.empty())
+            num = "1.0";
+
+        if (out.empty())
+            out += negate ? "-" : "";
+        else
+            out += negate ? " - " : " + ";
+        out += "(" + num + ")";
+        if (!den.empty())
+            out += " / (" + den + ")";
+    }
+    return out;
+}
+
+SeparablePlan SeparablePlan::analyze(const std::string &x, const std::string &y, const std::string &z)
+{
+    SeparablePlan plan;
+
+    const std::string *srcs[] = { &x, &y, &z };
+    const char *names[] = { "x", "y", "z" };
+    for (int i = 0; i < 3; i++) {
+        auto expr = Expr::parse(*srcs[i]);
+        if (!expr)
+            return {};
+        plan.glsl_xyz += "float " + std::string(names[i]) + " = " + separate(*expr, &plan.rows) + ";\n";
+    }
+
+    return plan;
+}
+
+
+
+float SeparableRow::eval(float s, float t) const
+{
+    float u = axis == DEP_U ? s : 0;
+    float v = axis == DEP_V ? s : 0;
+
+    float out = 1;
+    for (auto &factor : factors) {
+        float val = factor.expr->eval(u, v, t);
+        out = factor.inverse ? out / val : out * val;
+    }
+    return out;
+}
+
+
+
+void SeparableLut::rebuild(SeparablePlan plan, SeparableGrid grid)
+{
+    this->plan = std::move(plan);
+    this->grid = grid;
+
+    time_dependent = false;
+    for (auto &row : this->plan.rows)
+        time_dependent |= row.time_dependent;
+
+    if (!this->plan.active())
+        return;
+
+    width = std::max(grid.verts_x, grid.verts_y);
+    data.assign(width * this->plan.rows.size(), 0.f);
+    evaluate(evaluated_time, true);
+    dirty = true;
+}
+
+void SeparableLut::evaluate(float time, bool all_rows)
+{
+    for (size_t r = 0; r < plan.rows.size(); r++) {
+        const SeparableRow &row = plan.rows[r];
+        if (!all_rows && !row.time_dependent)
+            continue;
+
+        float *dst = &data[r * width];
+        if (row.axis == DEP_U) {
+            for (unsigned i = 0; i < grid.verts_x; i++)
+                dst[i] = row.eval(grid.u(i), time);
+        } else {
+            for (unsigned j = 0; j < grid.verts_y; j++)
+                dst[j] = row.eval(grid.v(j), time);
+        }
+    }
+    evaluated_time = time;
+}
+
+void SeparableLut::prepare(float time)
+{
+    if (!plan.active() || !time_dependent || time == evaluated_time)
+        return;
+    evaluate(time, false);
+    dirty = true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "expr.h"
+#include "object.h"
+
+struct SeparableFactor {
+    ExprRef expr;
+    bool inverse;
+};
+
+// One tabulated product of single-variable factors, sampled along u or v
+struct SeparableRow {
+    unsigned axis;
+    std::vector<SeparableFactor> factors;
+    bool time_dependent;
+    std::string key;
+
+    float eval(float s, float t) const;
+};
+
+// Splits each equation into sums of products and pulls every transcendental
+// factor that reads only u or only v into a row of a lookup table, so it is
+// evaluated once per grid line instead of once per vertex.
+struct SeparablePlan {
+    std::vector<SeparableRow> rows;
+    // Replacement for __INCLUDE_XYZ__ in shaders/surface_sep.vert
+    std::string glsl_xyz;
+
+    bool active() const
+    {
+        return !rows.empty();
+    }
+
+    static SeparablePlan analyze(const std::string &x, const std::string &y, const std::string &z);
+};
+
+// Sample positions of the surface grid, matching SurfaceEditor::create_mesh
+struct SeparableGrid {
+    unsigned verts_x = 0, verts_y = 0;
+    float x_min = 0, x_max = 0, y_min = 0, y_max = 0;
+
+    float u(unsigned i) const
+    {
+        return x_min + (float)i / (float)verts_x * (x_max - x_min);
+    }
+
+    float v(unsigned j) const
+    {
+        return y_min + (float)j / (float)verts_y * (y_max - y_min);
+    }
+};
+
+// The table itself, one row per SeparableRow, uploaded as a texture by
+// whoever draws the object
+struct SeparableLut : Component {
+    SeparablePlan plan;
+    SeparableGrid grid;
+
+    std::vector<float> data;
+    unsigned width = 0;
+    bool time_dependent = false;
+    float evaluated_time = 0;
+    // Changed since it was last uploaded
+    bool dirty = false;
+
+    void rebuild(SeparablePlan plan, SeparableGrid grid);
+    // Brings the time-dependent rows up to `time`
+    void prepare(float time);
+
+private:
+    void evaluate(float time, bool all_rows);
+};
@@ -1,9 +1,12 @@
 #include "shader.h"
 
 #include <array>
+#include <mutex>
 
 #include <GL/glew.h>
 
+#include "trace.h"
+
 Shader::Shader(int type)
 {
     this->id = glCreateShader(type);
@@ -23,6 +26,7 @@ ShaderProgram::ShaderProgram()
 
 std::optional<ShaderProgram> ShaderProgram::link(ShaderList shaders)
 {
+    TRACE_SCOPE("ShaderProgram::link");
     ShaderProgram program;
 
     for (auto it = shaders.begin(); it < shaders.end(); it++) {
@@ -44,17 +48,34 @@ std::optional<ShaderProgram> ShaderProgram::link(ShaderList shaders)
     return program;
 }
 
+bool defer_program_deletes = false;
+static std::mutex released_programs_lock;
+static std::vector<unsigned> released_programs;
+
 ShaderProgram::~ShaderProgram()
 {
     if (!this->valid)
         return;
+    if (defer_program_deletes) {
+        std::lock_guard<std::mutex> guard(released_programs_lock);
+        released_programs.push_back(this->id);
+        return;
+    }
     glDeleteProgram(this->id);
 }
 
+void TakeReleasedPrograms(std::vector<unsigned> *out)
+{
+    std::lock_guard<std::mutex> guard(released_programs_lock);
+    out->insert(out->end(), released_programs.begin(), released_programs.end());
+    released_programs.clear();
+}
+
 
 
 std::optional<Shader> LoadShaderFile(const std::string &filename, int type, ShaderMod mod)
 {
+    TRACE_SCOPE("LoadShaderFile");
     Shader shader(type);
     
     FILE *file = fopen(filename.c_str(), "r");
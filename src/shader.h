@@ -4,7 +4,9 @@
 #include <string>
 #include <functional>
 #include <initializer_list>
+#include <vector>
 
+#include "funcref.h"
 #include "resource.h"
 
 struct Shader {
@@ -30,6 +32,11 @@ private:
     ShaderProgram();
 };
 
-typedef std::function<void (std::string *)> ShaderMod;
+// Set while another context may still be drawing with programs this one
+// destroys. Their deletion then waits for TakeReleasedPrograms.
+extern bool defer_program_deletes;
+void TakeReleasedPrograms(std::vector<unsigned> *out);
+
+typedef FunctionRef<void (std::string *)> ShaderMod;
 std::optional<Shader> LoadShaderFile(const std::string &filename, int type, ShaderMod mod);
 std::optional<Shader> LoadShaderFile(const std::string &filename, int type);
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "optref.h"
+
+// Stays valid for as long as the value it was made for. A slot that has
+// been reused carries a newer generation, so stale handles find nothing.
+struct SlotHandle {
+    uint32_t index;
+    uint32_t generation;
+
+    bool operator==(const SlotHandle &other) const
+    {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const SlotHandle &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+// Values packed into one array for iteration, found through a table of
+// slots that only ever grows. Insertion and erasure are O(1). Erasure moves
+// the last value into the hole, so references into the map only last until
+// the next insert or erase.
+template <typename T>
+struct SlotMap {
+    struct Slot {
+        uint32_t dense;
+        uint32_t generation;
+    };
+
+    std::vector<T> values;
+    // Slot of each entry in `values`
+    std::vector<uint32_t> value_slots;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+
+    SlotHandle insert(T value)
+    {
+        uint32_t index;
+        if (free_slots.empty()) {
+            index = slots.size();
+            slots.push_back({ 0, 0 });
+        } else {
+            index = free_slots.back();
+            free_slots.pop_back();
+        }
+
+        Slot &slot = slots[index];
+        slot.dense = values.size();
+        values.push_back(std::move(value));
+        value_slots.push_back(index);
+        return { index, slot.generation };
+    }
+
+    bool contains(SlotHandle handle) const
+    {
+        return handle.index < slots.size() && slots[handle.index].generation == handle.generation;
+    }
+
+    optref<T> get(SlotHandle handle)
+    {
+        if (!contains(handle))
+            return {};
+        T &ref_t = values[slots[handle.index].dense];
+        return ref_t;
+    }
+
+    // Throws std::bad_optional_access for stale handles, like map::at
+    T &at(SlotHandle handle)
+    {
+        return get(handle).value();
+    }
+
+    SlotHandle handle_at(size_t dense)
+    {
+        uint32_t index = value_slots[dense];
+        return { index, slots[index].generation };
+    }
+
+    bool erase(SlotHandle handle)
+    {
+        if (!contains(handle))
+            return false;
+
+        Slot &slot = slots[handle.index];
+        uint32_t last = values.size() - 1;
+        if (slot.dense != last) {
+            std::swap(values[slot.dense], values[last]);
+            value_slots[slot.dense] = value_slots[last];
+            slots[value_slots[slot.dense]].dense = slot.dense;
+        }
+        values.pop_back();
+        value_slots.pop_back();
+
+        slot.generation++;
+        free_slots.push_back(handle.index);
+        return true;
+    }
+
+    void clear()
+    {
+        for (size_t i = values.size(); i > 0; i--)
+            erase(handle_at(i - 1));
+    }
+
+    size_t size() const
+    {
+        return values.size();
+    }
+
+    typename std::vector<T>::iterator begin()
+    {
+        return values.begin();
+    }
+
+    typename std::vector<T>::iterator end()
+    {
+        return values.end();
+    }
+};
@@ -0,0 +1,330 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <GL/glew.h>
+
+#include <imgui_impl_opengl3.h>
+
+#include "gpuprofiler.h"
+#include "trace.h"
+
+// Bytes per glBufferSubData call while uploading meshes
+#define UPLOAD_CHUNK (256 * 1024)
+
+template <typename T>
+static void CopyVector(ImVector<T> *dst, const ImVector<T> &src)
+{
+    // resize() only ever grows the allocation
+    dst->resize(src.Size);
+    if (src.Size)
+        memcpy(dst->Data, src.Data, src.size_in_bytes());
+}
+
+UiSnapshot::~UiSnapshot()
+{
+    for (ImDrawList *list : lists)
+        IM_DELETE(list);
+}
+
+void UiSnapshot::copy(const ImDrawData *src)
+{
+    TRACE_SCOPE("UiSnapshot::copy");
+    while (lists.size() < (size_t)src->CmdListsCount)
+        lists.push_back(IM_NEW(ImDrawList)(nullptr));
+
+    for (int i = 0; i < src->CmdListsCount; i++) {
+        const ImDrawList *in = src->CmdLists[i];
+        ImDrawList *out = lists[i];
+        CopyVector(&out->CmdBuffer, in->CmdBuffer);
+        CopyVector(&out->IdxBuffer, in->IdxBuffer);
+        CopyVector(&out->VtxBuffer, in->VtxBuffer);
+        out->Flags = in->Flags;
+    }
+
+    data = *src;
+    data.CmdLists = lists.data();
+}
+
+
+
+void SnapshotRenderer::draw(FrameSnapshot *snap)
+{
+    TRACE_SCOPE("SnapshotRenderer::draw");
+    if (snap->ready) {
+        glWaitSync((GLsync)snap->ready, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync((GLsync)snap->ready);
+        snap->ready = nullptr;
+    }
+
+    latency->collect(false);
+    gpu_profiler->begin_frame();
+
+    // Nothing queued after this snapshot uses them
+    for (uint64_t key : snap->released_keys) {
+        auto found = objects.find(key);
+        if (found == objects.end())
+            continue;
+        found->second.vao.release(&buffers);
+        found->second.back.release(&buffers);
+        objects.erase(found);
+    }
+    snap->released_keys.clear();
+    retired_programs.insert(retired_programs.end(), snap->released_programs.begin(), snap->released_programs.end());
+    snap->released_programs.clear();
+    delete_programs();
+
+    glViewport(0, 0, snap->view_w, snap->view_h);
+    glEnable(GL_DEPTH_TEST);
+
+    // Redirect the scene into the scaled target
+    GLint outer_fbo = 0;
+    int scene_w = snap->scene_w, scene_h = snap->scene_h;
+    bool redirected = scene_w != snap->view_w || scene_h != snap->view_h;
+    if (redirected) {
+        if (!scene_target || scene_target->width != snap->view_w || scene_target->height != snap->view_h)
+            scene_target.emplace(snap->view_w, snap->view_h);
+
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &outer_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, scene_target->fbo);
+        glViewport(0, 0, scene_w, scene_h);
+    }
+
+    gpu_profiler->begin("Clear");
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    gpu_profiler->end();
+
+    size_t budget = snap->upload_budget ? snap->upload_budget : SIZE_MAX;
+    for (size_t i = 0; i < snap->draw_count; i++) {
+        DrawItem *item = &snap->draws[i];
+        gpu_profiler->begin(item->label);
+        draw_item(*snap, item, &budget);
+        gpu_profiler->end();
+    }
+    backlog = 0;
+    for (auto &entry : objects)
+        backlog += entry.second.upload.remaining();
+    TRACE_COUNTER("Upload Backlog", backlog);
+    buffers.end_frame();
+
+    if (redirected) {
+        gpu_profiler->begin("Upscale");
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_target->fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, outer_fbo);
+        glBlitFramebuffer(0, 0, scene_w, scene_h, 0, 0, snap->view_w, snap->view_h,
+            GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, outer_fbo);
+        glViewport(0, 0, snap->view_w, snap->view_h);
+        gpu_profiler->end();
+    }
+
+    if (snap->has_ui) {
+        gpu_profiler->begin("ImGui");
+        ImGui_ImplOpenGL3_RenderDrawData(&snap->ui.data);
+        gpu_profiler->end();
+    }
+
+    latency->mark(snap->inputs, LatencyTracker::Submitted);
+}
+
+void SnapshotRenderer::start_upload(ObjectState *state, DrawItem *item)
+{
+    // Replaces whatever was still on its way
+    MeshUpload &upload = state->upload;
+    upload.active = true;
+    upload.vertices.swap(item->vertices);
+    upload.indices.swap(item->indices);
+    upload.vertex_done = upload.index_done = 0;
+    upload.lut = upload.lut_dirty = false;
+
+    // Meshes are rarely uploaded twice in a row, so don't hold on to a
+    // copy in every slot
+    std::vector<Vertex>().swap(item->vertices);
+    std::vector<VIndices>().swap(item->indices);
+
+    state->back.reserve(&buffers, upload.vertices.size() * sizeof(Vertex), upload.indices.size() * sizeof(VIndices));
+}
+
+void SnapshotRenderer::continue_upload(ObjectState *state, size_t *budget)
+{
+    MeshUpload &upload = state->upload;
+    if (!upload.active)
+        return;
+    TRACE_SCOPE("SnapshotRenderer::continue_upload");
+
+    size_t vertex_bytes = upload.vertices.size() * sizeof(Vertex);
+    size_t index_bytes = upload.indices.size() * sizeof(VIndices);
+    const char *vertices = (const char *)upload.vertices.data();
+    const char *indices = (const char *)upload.indices.data();
+
+    while (*budget && upload.vertex_done < vertex_bytes) {
+        size_t bytes = std::min({ (size_t)UPLOAD_CHUNK, vertex_bytes - upload.vertex_done, *budget });
+        state->back.write_vertices(upload.vertex_done, vertices + upload.vertex_done, bytes);
+        upload.vertex_done += bytes;
+        *budget -= bytes;
+    }
+    while (*budget && upload.index_done < index_bytes) {
+        size_t bytes = std::min({ (size_t)UPLOAD_CHUNK, index_bytes - upload.index_done, *budget });
+        state->back.write_indices(upload.index_done, indices + upload.index_done, bytes);
+        upload.index_done += bytes;
+        *budget -= bytes;
+    }
+    if (upload.vertex_done < vertex_bytes || upload.index_done < index_bytes)
+        return;
+
+    // Complete, the old buffers go back to the pool once the GPU is done
+    // drawing them
+    state->back.index_count = index_bytes / sizeof(unsigned);
+    std::swap(state->vao, state->back);
+    state->back.release(&buffers);
+    if (upload.lut_dirty)
+        set_lut(state, upload.lut_data, upload.lut_width, upload.lut_rows);
+    if (upload.lut)
+        state->lut_grid = upload.lut_grid;
+    state->program = upload.program;
+    state->separable = upload.lut;
+
+    upload.active = false;
+    upload.vertex_done = upload.index_done = 0;
+    std::vector<Vertex>().swap(upload.vertices);
+    std::vector<VIndices>().swap(upload.indices);
+    std::vector<float>().swap(upload.lut_data);
+}
+
+// Writes the item's vertex ranges over the mesh, or over the one on its way
+// in. They're always written, since skipping any would leave the mesh wrong
+// for good, but count against the budget.
+void SnapshotRenderer::patch_mesh(ObjectState *state, const DrawItem &item, size_t *budget)
+{
+    TRACE_SCOPE("SnapshotRenderer::patch_mesh");
+    MeshUpload &upload = state->upload;
+    const Vertex *data = item.vertices.data();
+    size_t written = 0;
+    for (const MeshRange &range : item.vertex_ranges) {
+        size_t offset = range.first * sizeof(Vertex), bytes = range.count * sizeof(Vertex);
+        if (upload.active) {
+            std::copy(data, data + range.count, upload.vertices.begin() + range.first);
+            // Anything before vertex_done already went out
+            if (offset < upload.vertex_done) {
+                size_t sent = std::min(bytes, upload.vertex_done - offset);
+                state->back.write_vertices(offset, data, sent);
+                written += sent;
+            }
+        } else {
+            state->vao.write_vertices(offset, data, bytes);
+            written += bytes;
+        }
+        data += range.count;
+    }
+    *budget -= std::min(written, *budget);
+}
+
+void SnapshotRenderer::set_lut(ObjectState *state, const std::vector<float> &data, unsigned width, unsigned rows)
+{
+    if (!state->lut)
+        state->lut.emplace();
+    if (state->lut_width == width && state->lut_rows == rows) {
+        state->lut->update_float_data(data.data(), width, rows);
+    } else {
+        state->lut->set_float_data(data.data(), width, rows);
+        state->lut_width = width;
+        state->lut_rows = rows;
+    }
+}
+
+void SnapshotRenderer::delete_programs()
+{
+    for (size_t i = retired_programs.size(); i > 0; i--) {
+        unsigned program = retired_programs[i - 1];
+        bool drawn = false;
+        for (auto &entry : objects)
+            drawn |= entry.second.program == program;
+        if (drawn)
+            continue;
+        glDeleteProgram(program);
+        retired_programs[i - 1] = retired_programs.back();
+        retired_programs.pop_back();
+    }
+}
+
+void SnapshotRenderer::draw_item(const FrameSnapshot &snap, DrawItem *item, size_t *budget)
+{
+    ObjectState &state = objects[item->key];
+
+    if (item->upload_mesh)
+        start_upload(&state, item);
+    else if (!item->vertex_ranges.empty())
+        patch_mesh(&state, *item, budget);
+
+    // The program and table may only fit the new mesh, so they wait for it
+    MeshUpload &upload = state.upload;
+    if (upload.active) {
+        upload.program = item->program;
+    } else {
+        state.program = item->program;
+        state.separable = item->lut;
+    }
+    if (item->lut && upload.active) {
+        if (item->upload_lut) {
+            upload.lut_data.swap(item->lut_data);
+            upload.lut_width = item->lut_width;
+            upload.lut_rows = item->lut_rows;
+            upload.lut_dirty = true;
+        }
+        upload.lut = true;
+        upload.lut_grid = item->lut_grid;
+    } else if (item->lut) {
+        if (item->upload_lut)
+            set_lut(&state, item->lut_data, item->lut_width, item->lut_rows);
+        state.lut_grid = item->lut_grid;
+    }
+    continue_upload(&state, budget);
+
+    // Nothing complete to draw yet
+    unsigned program = state.program;
+    if (!program)
+        return;
+    glUseProgram(program);
+
+    GLint u_time = glGetUniformLocation(program, "u_time");
+    GLint u_model = glGetUniformLocation(program, "u_model");
+    GLint u_view = glGetUniformLocation(program, "u_view");
+    GLint u_proj = glGetUniformLocation(program, "u_proj");
+    glUniform1f(u_time, snap.time);
+    glUniformMatrix4fv(u_model, 1, GL_FALSE, glm::value_ptr(item->model));
+    glUniformMatrix4fv(u_view, 1, GL_FALSE, glm::value_ptr(snap.view));
+    glUniformMatrix4fv(u_proj, 1, GL_FALSE, glm::value_ptr(snap.projection));
+
+    if (state.separable && state.lut) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, state.lut->texture);
+
+        const SeparableGrid &grid = state.lut_grid;
+        GLint u_lut = glGetUniformLocation(program, "u_lut");
+        GLint u_grid = glGetUniformLocation(program, "u_grid");
+        GLint u_grid_max = glGetUniformLocation(program, "u_grid_max");
+        glUniform1i(u_lut, 0);
+        glUniform4f(u_grid, grid.x_min, grid.y_min,
+            (grid.x_max - grid.x_min) / grid.verts_x,
+            (grid.y_max - grid.y_min) / grid.verts_y);
+        glUniform2i(u_grid_max, grid.verts_x - 1, grid.verts_y - 1);
+    }
+
+    state.vao.draw();
+}
+
+void SnapshotRenderer::release()
+{
+    for (auto &entry : objects) {
+        entry.second.vao.release(&buffers);
+        entry.second.back.release(&buffers);
+    }
+    objects.clear();
+    for (unsigned program : retired_programs)
+        glDeleteProgram(program);
+    retired_programs.clear();
+    buffers.clear();
+    scene_target.reset();
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <imgui.h>
+
+#include "framebuffer.h"
+#include "glm.h"
+#include "latency.h"
+#include "renderer.h"
+#include "texture.h"
+
+struct GpuProfiler;
+
+// A copy of the frame's ImGui draw lists. ImGui reuses its own lists on
+// the next NewFrame, so the copy is what gets drawn. Buffers keep their
+// capacity from frame to frame.
+struct UiSnapshot {
+    ImDrawData data;
+    std::vector<ImDrawList *> lists;
+
+    UiSnapshot()
+    {
+    }
+    UiSnapshot(const UiSnapshot &) = delete;
+    ~UiSnapshot();
+
+    void copy(const ImDrawData *src);
+};
+
+// Everything the GL backend needs to draw a frame, built by the simulation
+// and read only by the renderer. Nothing in it points back into the scene.
+struct FrameSnapshot {
+    float time;
+    int view_w, view_h;
+    // Smaller than the view when the ResolutionScaler shrank the scene
+    int scene_w, scene_h;
+    glm::mat4 view, projection;
+
+    // Only `draw_count` of `draws` are used, the rest keep their buffers
+    std::vector<DrawItem> draws;
+    size_t draw_count = 0;
+
+    bool has_ui = false;
+    UiSnapshot ui;
+
+    // Bytes of mesh data to upload while drawing this frame, 0 for all
+    size_t upload_budget = 0;
+
+    // Released since the previous snapshot, nothing later draws with them
+    std::vector<uint64_t> released_keys;
+    std::vector<unsigned> released_programs;
+
+    LatencyTracker::Inputs inputs;
+    // Fenced on the context that built the snapshot, when that isn't the
+    // one drawing it
+    void *ready = nullptr;
+};
+
+// Owns the GL state behind snapshots: every object's buffers and lookup
+// table, and the target the scene is drawn into when the ResolutionScaler
+// shrinks it. Only used on the thread whose context made them.
+struct SnapshotRenderer {
+    SnapshotRenderer(GpuProfiler *gpu_profiler, LatencyTracker *latency):
+        gpu_profiler(gpu_profiler), latency(latency)
+    {
+    }
+
+    void draw(FrameSnapshot *snap);
+    // Deletes everything, on the thread that made it
+    void release();
+
+    // Bytes of mesh data left to upload after the last draw
+    size_t upload_backlog() const
+    {
+        return backlog;
+    }
+
+    const GpuBufferPool &buffer_pool() const
+    {
+        return buffers;
+    }
+
+private:
+    // A mesh on its way into the back buffers, along with the program and
+    // table drawn with it. Until it's all there, the last complete mesh is
+    // drawn with the program and table it came with.
+    struct MeshUpload {
+        bool active = false;
+        unsigned program = 0;
+        std::vector<Vertex> vertices;
+        std::vector<VIndices> indices;
+        size_t vertex_done = 0, index_done = 0;
+
+        bool lut = false;
+        // A newer table came along with the mesh
+        bool lut_dirty = false;
+        std::vector<float> lut_data;
+        unsigned lut_width, lut_rows;
+        SeparableGrid lut_grid;
+
+        size_t remaining() const
+        {
+            return vertices.size() * sizeof(Vertex) - vertex_done + indices.size() * sizeof(VIndices) - index_done;
+        }
+    };
+
+    struct ObjectState {
+        // Drawn, and being uploaded into
+        VertArrayObj vao, back;
+        MeshUpload upload;
+        // What the drawn mesh is drawn with
+        unsigned program = 0;
+        bool separable = false;
+
+        std::optional<Texture> lut;
+        unsigned lut_width = 0, lut_rows = 0;
+        SeparableGrid lut_grid;
+    };
+
+    GpuProfiler *gpu_profiler;
+    LatencyTracker *latency;
+
+    std::unordered_map<uint64_t, ObjectState> objects;
+    // Released, but still drawn with until an upload completes
+    std::vector<unsigned> retired_programs;
+    GpuBufferPool buffers;
+    size_t backlog = 0;
+    // Sized to the whole view, so changing the scale only moves the viewport
+    std::optional<Framebuffer> scene_target;
+
+    void draw_item(const FrameSnapshot &snap, DrawItem *item, size_t *budget);
+    void start_upload(ObjectState *state, DrawItem *item);
+    void continue_upload(ObjectState *state, size_t *budget);
+    void patch_mesh(ObjectState *state, const DrawItem &item, size_t *budget);
+    void set_lut(ObjectState *state, const std::vector<float> &data, unsigned width, unsigned rows);
+    void delete_programs();
+};
@@ -0,0 +1,178 @@
+#include "softraster.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "framebuffer.h"
+#include "renderer.h"
+#include "threadpool.h"
+
+// Four pixels of a row at a time. GCC/clang vector extensions lower to
+// SSE/NEON natively and to wasm SIMD under emscripten.
+typedef float f32x4 __attribute__((vector_size(16)));
+typedef int32_t i32x4 __attribute__((vector_size(16)));
+
+// Triangles per setup/binning job
+#define SETUP_GRAIN 4096
+
+static uint32_t pack_rgba(glm::vec3 c)
+{
+    auto channel = [](float f) {
+        f = f < 0 ? 0 : (f > 1 ? 1 : f);
+        return (uint32_t)(f * 255.f + 0.5f);
+    };
+    return channel(c.x) | channel(c.y) << 8 | channel(c.z) << 16 | 0xFFu << 24;
+}
+
+void SoftRasterizer::begin_frame(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    color.assign(width * height, pack_rgba(glm::zero<glm::vec3>()));
+    tris.clear();
+    used_chunks = 0;
+}
+
+void SoftRasterizer::submit(const std::vector<SoftVertex> &verts, const std::vector<VIndices> &indices)
+{
+    size_t num_tiles = tiles_x * tiles_y;
+    size_t first_tri = tris.size();
+    size_t first_chunk = used_chunks;
+    size_t chunks = (indices.size() + SETUP_GRAIN - 1) / SETUP_GRAIN;
+
+    tris.resize(first_tri + indices.size());
+    used_chunks += chunks;
+    if (bins.size() < used_chunks * num_tiles)
+        bins.resize(used_chunks * num_tiles);
+    for (size_t i = first_chunk * num_tiles; i < used_chunks * num_tiles; i++)
+        bins[i].clear();
+
+    float w = (float)width, h = (float)height;
+
+    pool->parallel_for(indices.size(), SETUP_GRAIN, [&](size_t begin, size_t end) {
+        std::vector<uint32_t> *chunk_bins = &bins[(first_chunk + begin / SETUP_GRAIN) * num_tiles];
+
+        for (size_t i = begin; i < end; i++) {
+            const unsigned *idx = &indices[i].first;
+            const SoftVertex *v[3] = { &verts[idx[0]], &verts[idx[1]], &verts[idx[2]] };
+
+            // No near-plane clipping: drop anything crossing the eye plane
+            if (v[0]->clip.w <= 1e-5f || v[1]->clip.w <= 1e-5f || v[2]->clip.w <= 1e-5f)
+                continue;
+
+            float sx[3], sy[3], sz[3];
+            for (int k = 0; k < 3; k++) {
+                float inv_w = 1.f / v[k]->clip.w;
+                sx[k] = (v[k]->clip.x * inv_w * 0.5f + 0.5f) * w;
+                sy[k] = (0.5f - v[k]->clip.y * inv_w * 0.5f) * h;
+                sz[k] = v[k]->clip.z * inv_w * 0.5f + 0.5f;
+            }
+
+            float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+            if (fabsf(area) < 1e-8f)
+                continue;
+
+            Tri &tri = tris[first_tri + i];
+            tri.min_x = std::max(0, (int)floorf(std::min({ sx[0], sx[1], sx[2] })));
+            tri.min_y = std::max(0, (int)floorf(std::min({ sy[0], sy[1], sy[2] })));
+            tri.max_x = std::min(width - 1, (int)ceilf(std::max({ sx[0], sx[1], sx[2] })));
+            tri.max_y = std::min(height - 1, (int)ceilf(std::max({ sy[0], sy[1], sy[2] })));
+            if (tri.min_x > tri.max_x || tri.min_y > tri.max_y)
+                continue;
+
+            // Surfaces are two-sided, so accept both windings
+            float inv_area = 1.f / area;
+            for (int k = 0; k < 3; k++) {
+                int k1 = (k + 1) % 3, k2 = (k + 2) % 3;
+                tri.a[k] = (sy[k1] - sy[k2]) * inv_area;
+                tri.b[k] = (sx[k2] - sx[k1]) * inv_area;
+                tri.c[k] = (sx[k1] * sy[k2] - sx[k2] * sy[k1]) * inv_area;
+                tri.z[k] = sz[k];
+                tri.color[k] = v[k]->color;
+            }
+
+            for (int ty = tri.min_y / TILE_SIZE; ty <= tri.max_y / TILE_SIZE; ty++) {
+                for (int tx = tri.min_x / TILE_SIZE; tx <= tri.max_x / TILE_SIZE; tx++) {
+                    chunk_bins[ty * tiles_x + tx].push_back(first_tri + i);
+                }
+            }
+        }
+    });
+}
+
+void SoftRasterizer::raster_tile(int tile)
+{
+    int tile_x0 = (tile % tiles_x) * TILE_SIZE;
+    int tile_y0 = (tile / tiles_x) * TILE_SIZE;
+    int tile_x1 = std::min(tile_x0 + TILE_SIZE, width) - 1;
+    int tile_y1 = std::min(tile_y0 + TILE_SIZE, height) - 1;
+
+    alignas(16) float depth[TILE_SIZE * TILE_SIZE];
+    std::fill(depth, depth + TILE_SIZE * TILE_SIZE, 1.f);
+
+    const f32x4 lane_offs = { 0.5f, 1.5f, 2.5f, 3.5f };
+    const i32x4 lane_idx = { 0, 1, 2, 3 };
+    size_t num_tiles = tiles_x * tiles_y;
+
+    for (size_t chunk = 0; chunk < used_chunks; chunk++) {
+        for (uint32_t tri_idx : bins[chunk * num_tiles + tile]) {
+            const Tri &tri = tris[tri_idx];
+
+            int x0 = std::max(tri.min_x, tile_x0);
+            int x1 = std::min(tri.max_x, tile_x1);
+            int y0 = std::max(tri.min_y, tile_y0);
+            int y1 = std::min(tri.max_y, tile_y1);
+            // Keep the 4-wide steps aligned within the tile's depth rows
+            x0 = tile_x0 + ((x0 - tile_x0) & ~3);
+
+            for (int y = y0; y <= y1; y++) {
+                float py = y + 0.5f;
+                float row_b[3];
+                for (int k = 0; k < 3; k++)
+                    row_b[k] = tri.b[k] * py + tri.c[k];
+
+                float *depth_row = &depth[(y - tile_y0) * TILE_SIZE];
+                uint32_t *color_row = &color[y * width];
+
+                for (int x = x0; x <= x1; x += 4) {
+                    f32x4 px = (float)x + lane_offs;
+                    f32x4 b0 = tri.a[0] * px + row_b[0];
+                    f32x4 b1 = tri.a[1] * px + row_b[1];
+                    f32x4 b2 = tri.a[2] * px + row_b[2];
+
+                    i32x4 inside = (b0 >= 0) & (b1 >= 0) & (b2 >= 0) & ((x + lane_idx) <= x1);
+                    f32x4 z = b0 * tri.z[0] + b1 * tri.z[1] + b2 * tri.z[2];
+
+                    f32x4 old_z;
+                    memcpy(&old_z, &depth_row[x - tile_x0], sizeof(old_z));
+                    i32x4 pass = inside & (z < old_z) & (z >= 0);
+
+                    for (int l = 0; l < 4; l++) {
+                        if (!pass[l])
+                            continue;
+                        depth_row[x - tile_x0 + l] = z[l];
+                        glm::vec3 c = b0[l] * tri.color[0] + b1[l] * tri.color[1] + b2[l] * tri.color[2];
+                        color_row[x + l] = pack_rgba(c);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void SoftRasterizer::end_frame()
+{
+    pool->parallel_for(tiles_x * tiles_y, 1, [&](size_t begin, size_t end) {
+        for (size_t tile = begin; tile < end; tile++)
+            raster_tile(tile);
+    });
+}
+
+bool SoftRasterizer::save_ppm(const std::string &path)
+{
+    return WritePPM(path, (const uint8_t *)&color[0], width, height, false);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "glm.h"
+
+struct ThreadPool;
+struct Vertex;
+struct VIndices;
+
+// Post-transform vertex: clip-space position and shaded color
+struct SoftVertex {
+    glm::vec4 clip;
+    glm::vec3 color;
+};
+
+// CPU stand-in for a shader program: model-space position and color of a
+// mesh vertex at the given time
+typedef std::function<void (const Vertex &in, float time, glm::vec3 *pos, glm::vec3 *color)> SoftShader;
+
+// CPU fallback for machines without a usable GL. Every draw in a frame is
+// set up and binned into screen tiles as it is submitted, then end_frame()
+// rasterizes the tiles in parallel, each against its own depth buffer.
+struct SoftRasterizer {
+    static constexpr int TILE_SIZE = 64;
+
+    ThreadPool *pool;
+    int width = 0, height = 0;
+    // RGBA8, top row first
+    std::vector<uint32_t> color;
+
+    SoftRasterizer(ThreadPool *pool):
+        pool(pool)
+    {
+    }
+
+    void begin_frame(int width, int height);
+    void submit(const std::vector<SoftVertex> &verts, const std::vector<VIndices> &indices);
+    void end_frame();
+
+    bool save_ppm(const std::string &path);
+
+private:
+    // Edge functions pre-divided by the triangle area, so they evaluate
+    // straight to barycentrics
+    struct Tri {
+        float a[3], b[3], c[3];
+        float z[3];
+        glm::vec3 color[3];
+        int min_x, min_y, max_x, max_y;
+    };
+
+    int tiles_x = 0, tiles_y = 0;
+    std::vector<Tri> tris;
+    // One bin per (setup chunk, tile), so binning needs no locks
+    std::vector<std::vector<uint32_t>> bins;
+    size_t used_chunks = 0;
+
+    void raster_tile(int tile);
+};
@@ -1,5 +1,6 @@
 #include "surface.h"
 
+#include <algorithm>
 #include <atomic>
 
 #include <imgui.h>
@@ -7,24 +8,36 @@
 
 #include <GL/glew.h>
 
+#include "game.h"
+#include "jobs.h"
 #include "renderer.h"
+#include "replay.h"
+#include "separable.h"
+#include "threadpool.h"
+#include "arena.h"
+#include "camera.h"
 #include "defer.h"
+#include "trace.h"
+
+// Vertices per parallel_for chunk when meshing
+#define MESH_CHUNK 16384
 
 void SurfaceEditor::update(GameState *ctx, Object *obj, float dt)
 {
-    (void)ctx;
     bool model_diff = false;
     bool eq_diff = false;
+    bool lod_diff = false;
+    bool adaptive = lod_params.adaptive;
 
     bool window_open = !obj->deleted;
 
-    std::string window_name = "Surface ";
-    window_name += std::to_string(eq_num);
+    char window_name[32];
+    snprintf(window_name, sizeof(window_name), "Surface %zu", eq_num);
 
-    ImGui::PushID(window_name.c_str());
+    ImGui::PushID(window_name);
     DEFER({ ImGui::PopID(); });
 
-    if (ImGui::CollapsingHeader(window_name.c_str(), &window_open))
+    if (ImGui::CollapsingHeader(window_name, &window_open))
     {
         eq_diff |= ImGui::InputText("x=", &eqs.x);
         eq_diff |= ImGui::InputText("y=", &eqs.y);
@@ -45,9 +58,33 @@ void SurfaceEditor::update(GameState *ctx, Object *obj, float dt)
         model_params.y_min = range_v[0];
         model_params.y_max = range_v[1];
 
+        lod_diff |= ImGui::Checkbox("Adaptive LOD", &lod_params.adaptive);
+        if (lod_params.adaptive) {
+            lod_diff |= ImGui::SliderFloat("Max Error (px)", &lod_params.max_error, 1.f, 32.f);
+            int patches = lod_params.max_patches;
+            lod_diff |= ImGui::InputInt("Max Patches", &patches);
+            lod_params.max_patches = std::max(1, patches);
+
+            const PatchTree::Stats &stats = lod.stats();
+            ImGui::Text("%u patches, %u triangles, depth %u", stats.leaves,
+                stats.leaves * PatchTree::PATCH_RES * PatchTree::PATCH_RES * 2, stats.depth);
+            ImGui::Text("Splits: %lu, merges: %lu, rebuilds: %lu", stats.splits, stats.merges, stats.builds);
+        }
+
         ImGui::Spacing();
     }
 
+    if (SessionLog *session = ctx->session) {
+        bool synced = session->sync("x=", &eqs.x, eq_diff);
+        synced |= session->sync("y=", &eqs.y, eq_diff);
+        synced |= session->sync("z=", &eqs.z, eq_diff);
+        eq_diff = synced;
+        model_diff = session->sync_value("Model Params", &model_params, model_diff);
+        lod_diff = session->sync_value("LOD Params", &lod_params, lod_diff);
+        bool closed = !window_open;
+        window_open = !session->sync_value("Close", &closed, closed);
+    }
+
     if (eq_diff) {
         recompile_timeout = 0.5;
     }
@@ -58,21 +95,45 @@ void SurfaceEditor::update(GameState *ctx, Object *obj, float dt)
             recompile_timeout = 0;
 
             printf("Refreshing equation...\n");
-
-            Renderer &renderer = obj->component<Renderer>().value();
-            auto new_shader = create_shader();
-            if (new_shader) {
-                renderer.shader = std::move(*new_shader);
+            queue_refresh_shader(ctx, obj);
+            if (lod_params.adaptive) {
+                // Patch bounds come from the equations
+                if (!lod.set_equations(eqs.x, eqs.y, eqs.z, depends_on_time())) {
+                    printf("Adaptive LOD can't evaluate these equations, using the grid\n");
+                    lod_params.adaptive = false;
+                    queue_remesh(ctx, obj, true);
+                }
+            } else if (render_backend == RenderBackend::Software) {
+                // Shading on the CPU costs as much as the grid is big
+                queue_remesh(ctx, obj, true);
             }
         }
     }
 
-    if (model_diff) {
+    bool rescaled = ctx->tess_scale != tess_scale;
+    tess_scale = ctx->tess_scale;
+
+    if (lod_params.adaptive != adaptive) {
+        printf("Switching adaptive LOD %s...\n", lod_params.adaptive ? "on" : "off");
+        if (lod_params.adaptive)
+            reset_lod(obj);
+        else
+            queue_remesh(ctx, obj, true);
+    } else if (model_diff) {
         printf("Refreshing model_params...\n");
+        if (lod_params.adaptive)
+            reset_lod(obj);
+        else
+            queue_remesh(ctx, obj, true);
+    } else if (rescaled && !lod_params.adaptive) {
+        queue_remesh(ctx, obj, false);
+    }
+
+    if (lod_params.adaptive)
+        update_lod(ctx, obj);
 
-        Mesh &mesh = obj->component<Mesh>().value();
-        auto new_mesh = create_mesh();
-        mesh = std::move(new_mesh);
+    if (time_dependent || recompile_timeout) {
+        ctx->request_redraw();
     }
 
     obj->deleted = !window_open;
@@ -80,27 +141,278 @@ void SurfaceEditor::update(GameState *ctx, Object *obj, float dt)
 
 
 
+// The surface a job was queued for, unless it's gone since
+static Object *FindSurface(World *world, EntityId entity, size_t eq_num)
+{
+    Object *obj = world->object(entity);
+    if (!obj || obj->deleted)
+        return nullptr;
+    auto editor = obj->component<SurfaceEditor>();
+    if (!editor || editor->get().eq_num != eq_num)
+        return nullptr;
+    return obj;
+}
+
+// Longest side of the grids an edit is shown at on its way to the one
+// asked for, the first built right away
+static const unsigned REFINE_LEVELS[] = { 64, 256, 1024 };
+static const char *const REMESH_JOB = "Remesh";
+
+static ModelParams CoarseParams(const ModelParams &params, unsigned level)
+{
+    ModelParams coarse = params;
+    unsigned longest = std::max(params.res_x, params.res_y);
+    if (longest > level) {
+        coarse.res_x = std::max(1u, (unsigned)((uint64_t)params.res_x * level / longest));
+        coarse.res_y = std::max(1u, (unsigned)((uint64_t)params.res_y * level / longest));
+    }
+    return coarse;
+}
+
+// Meshes the next level finer than `shown`, which queues the one after
+// once it's swapped in, until the grid is `target`. Every level is the
+// same job, so a new edit drops whichever is on its way.
+static void QueueRefinement(JobScheduler *jobs, World *world, EntityId entity, size_t eq_num,
+    const ModelParams &target, unsigned shown, bool urgent)
+{
+    unsigned longest = std::max(target.res_x, target.res_y);
+    ModelParams grid = target;
+    bool last = true;
+    for (unsigned level : REFINE_LEVELS) {
+        if (level > shown && level < longest) {
+            grid = CoarseParams(target, level);
+            last = false;
+            break;
+        }
+    }
+
+    Job job;
+    job.name = REMESH_JOB;
+    job.key = eq_num;
+    job.priority = urgent ? JobPriority::High : JobPriority::Normal;
+    job.deadline = urgent ? 0.1f : 0.5f;
+
+    unsigned level = std::max(grid.res_x, grid.res_y);
+    job.work = [=](const CancelToken &cancel) -> MainStep {
+        auto mesh = std::make_shared<Mesh>(CreateGridMesh(grid, &ThreadPool::shared(), &cancel));
+        if (cancel.is_cancelled())
+            return {};
+
+        return [=]() {
+            Object *obj = FindSurface(world, entity, eq_num);
+            SurfaceEditor *editor = obj ? &obj->component<SurfaceEditor>()->get() : nullptr;
+            // Patches took over while it was on its way
+            if (!editor || editor->lod_params.adaptive)
+                return true;
+            editor->apply_mesh(obj, std::move(*mesh), grid);
+            if (!last)
+                QueueRefinement(jobs, world, entity, eq_num, target, level, false);
+            return true;
+        };
+    };
+    jobs->submit(std::move(job));
+}
+
+void SurfaceEditor::queue_remesh(GameState *ctx, Object *obj, bool edited)
+{
+    ModelParams target = grid_params();
+    // Resolution scaling goes straight to the target, and can wait
+    if (!edited) {
+        QueueRefinement(&ctx->jobs, &ctx->world, obj->entity, eq_num, target, ~0u, false);
+        return;
+    }
+    // Small enough to build within the frame, so nothing on its way is
+    // newer than this
+    if (std::max(target.res_x, target.res_y) <= REFINE_LEVELS[0]) {
+        ctx->jobs.cancel(REMESH_JOB, eq_num);
+        apply_mesh(obj, CreateGridMesh(target, &ThreadPool::shared()), target);
+        return;
+    }
+
+    ModelParams coarse = CoarseParams(target, REFINE_LEVELS[0]);
+    apply_mesh(obj, CreateGridMesh(coarse, &ThreadPool::shared()), coarse);
+    QueueRefinement(&ctx->jobs, &ctx->world, obj->entity, eq_num, target, REFINE_LEVELS[0], true);
+}
+
+void SurfaceEditor::apply_mesh(Object *obj, Mesh mesh, const ModelParams &grid)
+{
+    Mesh &current = obj->component<Mesh>()->get();
+    mesh.xform = current.xform;
+    current = std::move(mesh);
+    set_mesh_grid(obj, grid);
+}
+
+void SurfaceEditor::set_mesh_grid(Object *obj, const ModelParams &grid)
+{
+    mesh_params = grid;
+    if (render_backend != RenderBackend::GL)
+        return;
+
+    // Tables are sized to the grid, and the shader only changes if the
+    // grid no longer fits in one
+    SeparableLut &lut = obj->component<SeparableLut>()->get();
+    if (plan_separable().active() != lut.plan.active()) {
+        refresh_shader(obj);
+    } else if (lut.plan.active()) {
+        SeparablePlan plan = lut.plan;
+        lut.rebuild(std::move(plan), separable_grid());
+    }
+}
+
+void SurfaceEditor::reset_lod(Object *obj)
+{
+    if (!lod.set_equations(eqs.x, eqs.y, eqs.z, depends_on_time())) {
+        printf("Adaptive LOD can't evaluate these equations, using the grid\n");
+        lod_params.adaptive = false;
+        return;
+    }
+    lod.reset(model_params.x_min, model_params.x_max, model_params.y_min, model_params.y_max);
+
+    // Every patch samples the same lattice, which the lookup tables cover
+    ModelParams lattice = model_params;
+    lattice.res_x = lattice.res_y = PatchTree::LATTICE;
+    set_mesh_grid(obj, lattice);
+}
+
+void SurfaceEditor::update_lod(GameState *ctx, Object *obj)
+{
+    if (!ctx->main_camera)
+        return;
+    Camera &camera = ctx->objects.at(*ctx->main_camera).component<Camera>().value();
+    Mesh &mesh = obj->component<Mesh>()->get();
+
+    LodView view;
+    view.view_proj = camera.projection * camera.xform() * mesh.xform;
+    glm::vec4 eye = glm::inverse(mesh.xform) * glm::vec4(camera.pos, 1.f);
+    view.eye = glm::vec3(eye.x, eye.y, eye.z);
+    view.pixels_per_unit = camera.projection[1][1] * ctx->view_h / 2.f;
+
+    // The resolution scaler thins out patches like it would grid lines
+    LodParams params = lod_params;
+    params.max_patches = std::max(1u, (unsigned)(params.max_patches * tess_scale * tess_scale));
+
+    if (lod.update(view, params, ctx->time)) {
+        if (lod.build(&mesh.vertices, &mesh.indices, &mesh.dirty_ranges, &ThreadPool::shared()))
+            mesh.dirty = true;
+        // Keep going until it settles
+        ctx->request_redraw();
+    }
+}
+
+void SurfaceEditor::queue_refresh_shader(GameState *ctx, Object *obj)
+{
+    Job job;
+    job.name = "Refresh Shader";
+    job.key = eq_num;
+    job.priority = JobPriority::High;
+    job.deadline = 0.1f;
+
+    World *world = &ctx->world;
+    EntityId entity = obj->entity;
+    size_t eq_num = this->eq_num;
+    job.main = [world, entity, eq_num]() {
+        if (Object *obj = FindSurface(world, entity, eq_num))
+            obj->component<SurfaceEditor>()->get().refresh_shader(obj);
+        return true;
+    };
+    ctx->jobs.submit(std::move(job));
+}
+
+void SurfaceEditor::refresh_shader(Object *obj)
+{
+    Renderer &renderer = obj->component<Renderer>().value();
+
+    if (render_backend == RenderBackend::Software) {
+        auto new_shader = create_soft_shader();
+        if (!new_shader)
+            return;
+        renderer.soft_shader = std::move(*new_shader);
+        // Reshade the cached vertices
+        obj->component<Mesh>()->get().dirty = true;
+    } else {
+        auto new_shader = create_shader();
+        if (!new_shader)
+            return;
+        renderer.shader = std::move(*new_shader);
+        rebuild_lut(&obj->component<SeparableLut>()->get());
+    }
+
+    time_dependent = depends_on_time();
+    renderer.soft_animated = time_dependent;
+}
+
+bool SurfaceEditor::depends_on_time()
+{
+    for (const std::string *eq : { &eqs.x, &eqs.y, &eqs.z }) {
+        auto expr = Expr::parse(*eq);
+        // Anything we can't analyze might read t
+        if (!expr || ((*expr)->deps & DEP_T))
+            return true;
+    }
+    return false;
+}
+
+SeparablePlan SurfaceEditor::plan_separable()
+{
+    if (render_backend != RenderBackend::GL)
+        return {};
+
+    ModelParams grid = mesh_params;
+    GLint max_tex_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_tex_size);
+    if (std::max(grid.res_x, grid.res_y) + 1 > (unsigned)max_tex_size)
+        return {};
+
+    return SeparablePlan::analyze(eqs.x, eqs.y, eqs.z);
+}
+
+SeparableGrid SurfaceEditor::separable_grid() const
+{
+    SeparableGrid grid;
+    grid.verts_x = mesh_params.res_x + 1;
+    grid.verts_y = mesh_params.res_y + 1;
+    grid.x_min = mesh_params.x_min;
+    grid.x_max = mesh_params.x_max;
+    grid.y_min = mesh_params.y_min;
+    grid.y_max = mesh_params.y_max;
+    return grid;
+}
+
+void SurfaceEditor::rebuild_lut(SeparableLut *lut)
+{
+    lut->rebuild(plan_separable(), separable_grid());
+}
+
 std::optional<ShaderProgram> SurfaceEditor::create_shader()
 {
-    auto vertex_xform = [=](std::string *src){
+    TRACE_SCOPE("SurfaceEditor::create_shader");
+    SeparablePlan plan = plan_separable();
+
+    auto vertex_xform = [&](std::string *src){
         const char *needle = "__INCLUDE_XYZ__";
         size_t findpos = src->find(needle);
 
-        if (findpos != std::string::npos) {
-            char *glsl_xyz;
-            asprintf(&glsl_xyz,
-                "float x = %s;\n"
-                "float y = %s;\n"
-                "float z = %s;\n",
-                eqs.x.c_str(),
-                eqs.y.c_str(),
-                eqs.z.c_str()
-            );
-            src->replace(findpos, strlen(needle), glsl_xyz);
-            free(glsl_xyz);
+        if (findpos == std::string::npos)
+            return;
+
+        if (plan.active()) {
+            src->replace(findpos, strlen(needle), plan.glsl_xyz);
+            return;
+        }
+
+        const std::string *srcs[] = { &eqs.x, &eqs.y, &eqs.z };
+        FrameString glsl_xyz;
+        for (int i = 0; i < 3; i++) {
+            glsl_xyz += "float ";
+            glsl_xyz += "xyz"[i];
+            glsl_xyz += " = ";
+            glsl_xyz.append(srcs[i]->data(), srcs[i]->size());
+            glsl_xyz += ";\n";
         }
+        src->replace(findpos, strlen(needle), glsl_xyz.data(), glsl_xyz.size());
     };
-    auto sh_vertex = LoadShaderFile("shaders/surface.vert", GL_VERTEX_SHADER, vertex_xform);
+    const char *vertex_path = plan.active() ? "shaders/surface_sep.vert" : "shaders/surface.vert";
+    auto sh_vertex = LoadShaderFile(vertex_path, GL_VERTEX_SHADER, vertex_xform);
     if (!sh_vertex)
         return {};
 
@@ -117,13 +429,60 @@ std::optional<ShaderProgram> SurfaceEditor::create_shader()
 
 
 
-Mesh SurfaceEditor::create_mesh()
+std::optional<SoftShader> SurfaceEditor::create_soft_shader()
 {
-    unsigned res_x = model_params.res_x;
-    unsigned res_y = model_params.res_y;
+    ExprRef xyz[3];
+    const std::string *srcs[] = { &eqs.x, &eqs.y, &eqs.z };
+    for (int i = 0; i < 3; i++) {
+        auto expr = Expr::parse(*srcs[i]);
+        if (!expr) {
+            printf("The software renderer can't evaluate `%s`!\n", srcs[i]->c_str());
+            return {};
+        }
+        xyz[i] = *expr;
+    }
+
+    // Mirrors fn() and fn_normal() in shaders/surface.vert
+    return [x = xyz[0], y = xyz[1], z = xyz[2]](const Vertex &in, float t, glm::vec3 *pos, glm::vec3 *color) {
+        auto fn = [&](float u, float v) {
+            return glm::vec3(x->eval(u, v, t), y->eval(u, v, t), z->eval(u, v, t));
+        };
+
+        float u = in.x, v = in.z;
+        float eps = 0.01;
+        glm::vec3 df_du = fn(u + eps, v) - fn(u - eps, v);
+        glm::vec3 df_dv = fn(u, v + eps) - fn(u, v - eps);
+
+        *pos = fn(u, v);
+        *color = glm::normalize(glm::cross(df_du, df_dv)) * 0.5f + 0.5f;
+    };
+}
 
-    float x_min = model_params.x_min, x_max = model_params.x_max;
-    float y_min = model_params.y_min, y_max = model_params.y_max;
+
+
+ModelParams SurfaceEditor::grid_params() const
+{
+    ModelParams params = model_params;
+    if (tess_scale < 1.f) {
+        params.res_x = std::max(1u, (unsigned)(params.res_x * tess_scale));
+        params.res_y = std::max(1u, (unsigned)(params.res_y * tess_scale));
+    }
+    return params;
+}
+
+Mesh SurfaceEditor::create_mesh(ThreadPool *pool)
+{
+    return CreateGridMesh(grid_params(), pool);
+}
+
+Mesh CreateGridMesh(const ModelParams &params, ThreadPool *pool, const CancelToken *cancel)
+{
+    TRACE_SCOPE("CreateGridMesh");
+    unsigned res_x = params.res_x;
+    unsigned res_y = params.res_y;
+
+    float x_min = params.x_min, x_max = params.x_max;
+    float y_min = params.y_min, y_max = params.y_max;
 
     unsigned verts_x = res_x + 1;
     unsigned verts_y = res_y + 1;
@@ -134,44 +493,58 @@ Mesh SurfaceEditor::create_mesh()
     std::vector<Vertex> vertices(verts_x * verts_y);
     std::vector<VIndices> indices(res_x * res_y * 2);
 
-    for (unsigned i = 0; i < verts_x; i++) {
-        for (unsigned j = 0; j < verts_y; j++) {
-            float fract_x = (float)i / (float)verts_x;
-            float fract_y = (float)j / (float)verts_y;
+    // Split by grid column, enough of them per chunk to be worth a steal
+    size_t grain = std::max<size_t>(1, MESH_CHUNK / verts_y);
 
-            float pos_x = x_min + fract_x * width;
-            float pos_y = y_min + fract_y * height;
-            vertices[i*verts_y+j] = { pos_x, -1, pos_y, 0, 0 };
-        }
-    }
+    pool->parallel_for(verts_x, grain, [&](size_t begin, size_t end) {
+        for (unsigned i = begin; i < end; i++) {
+            for (unsigned j = 0; j < verts_y; j++) {
+                float fract_x = (float)i / (float)verts_x;
+                float fract_y = (float)j / (float)verts_y;
 
-    for (unsigned i = 0; i < res_x; i++) {
-        for (unsigned j = 0; j < res_y; j++) {
-            unsigned offs = 2 * (i*res_y + j);
-            indices[offs]   = { (i+0)*verts_y+(j+0), (i+1)*verts_y+(j+0), (i+0)*verts_y+(j+1) };
-            indices[offs+1] = { (i+1)*verts_y+(j+1), (i+1)*verts_y+(j+0), (i+0)*verts_y+(j+1) };
+                float pos_x = x_min + fract_x * width;
+                float pos_y = y_min + fract_y * height;
+                // Grid indices ride along in the texture coordinates for the
+                // lookup tables in surface_sep.vert
+                vertices[i*verts_y+j] = { pos_x, -1, pos_y, (float)i, (float)j };
+            }
         }
-    }
+    }, cancel);
+
+    pool->parallel_for(res_x, grain, [&](size_t begin, size_t end) {
+        for (unsigned i = begin; i < end; i++) {
+            for (unsigned j = 0; j < res_y; j++) {
+                unsigned offs = 2 * (i*res_y + j);
+                indices[offs]   = { (i+0)*verts_y+(j+0), (i+1)*verts_y+(j+0), (i+0)*verts_y+(j+1) };
+                indices[offs+1] = { (i+1)*verts_y+(j+1), (i+1)*verts_y+(j+0), (i+0)*verts_y+(j+1) };
+            }
+        }
+    }, cancel);
 
-    return { vertices, indices };
+    return Mesh(std::move(vertices), std::move(indices));
 }
 
 
 
 
-Object CreateSurface()
+Object CreateSurface(World *world)
 {
-    Object obj;
+    Object obj(world);
     static std::atomic_size_t eq_num = 1;
 
     SurfaceEditor surface_editor(eq_num.fetch_add(1));
-    Mesh mesh = surface_editor.create_mesh();
-    ShaderProgram shader = surface_editor.create_shader().value();
-    Renderer renderer(std::move(shader));
+    Mesh mesh = surface_editor.create_mesh(&ThreadPool::shared());
+    surface_editor.mesh_params = surface_editor.grid_params();
+    Renderer renderer(std::nullopt);
+    renderer.label = "Surface " + std::to_string(surface_editor.eq_num);
+    SeparableLut lut;
 
     obj.add_component(std::move(surface_editor));
     obj.add_component(std::move(renderer));
     obj.add_component(std::move(mesh));
+    obj.add_component(std::move(lut));
+
+    obj.component<SurfaceEditor>()->get().refresh_shader(&obj);
 
     return obj;
 }
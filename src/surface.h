@@ -3,7 +3,10 @@
 #include <optional>
 #include <string>
 
+#include "lod.h"
 #include "object.h"
+#include "renderer.h"
+#include "softraster.h"
 
 struct Equations {
     std::string x = "u";
@@ -16,15 +19,27 @@ struct ModelParams {
     float x_min = -3, x_max = 3, y_min = -3, y_max = 3;
 };
 
-struct ShaderProgram;
-struct Mesh;
+struct SeparablePlan;
+struct SeparableLut;
+struct ThreadPool;
+struct CancelToken;
 
 struct SurfaceEditor : Component {
     size_t eq_num;
 
     Equations eqs;
     ModelParams model_params;
-    float recompile_timeout;
+    float recompile_timeout = 0;
+    bool time_dependent = true;
+    // Copy of GameState::tess_scale the current mesh was built with
+    float tess_scale = 1.f;
+    // Grid of the mesh being drawn, coarser than grid_params() while an
+    // edit is being refined
+    ModelParams mesh_params;
+
+    // Replaces the uniform grid with patches picked for the camera
+    LodParams lod_params;
+    PatchTree lod;
 
     SurfaceEditor(size_t eq_num):
         eq_num(eq_num)
@@ -33,8 +48,31 @@ struct SurfaceEditor : Component {
 
     void update(GameState *ctx, Object *obj, float dt);
 
-    Mesh create_mesh();
+    ModelParams grid_params() const;
+    SeparableGrid separable_grid() const;
+    Mesh create_mesh(ThreadPool *pool);
     std::optional<ShaderProgram> create_shader();
+    std::optional<SoftShader> create_soft_shader();
+    SeparablePlan plan_separable();
+    bool depends_on_time();
+    void rebuild_lut(SeparableLut *lut);
+    void refresh_shader(Object *obj);
+    // Swaps in a mesh built for `grid`, along with what depends on it
+    void apply_mesh(Object *obj, Mesh mesh, const ModelParams &grid);
+    void set_mesh_grid(Object *obj, const ModelParams &grid);
+
+    // Starts adaptive LOD over from a single patch, or turns it off if the
+    // equations can't be evaluated on the CPU
+    void reset_lod(Object *obj);
+    void update_lod(GameState *ctx, Object *obj);
+
+    // Meshes in the background, then swaps the mesh in. Changes the user
+    // made show a coarse grid at once and refine it in steps.
+    void queue_remesh(GameState *ctx, Object *obj, bool edited);
+    void queue_refresh_shader(GameState *ctx, Object *obj);
 };
 
-Object CreateSurface();
\ No newline at end of file
+// Stops early, with a partial mesh, once `cancel` fires
+Mesh CreateGridMesh(const ModelParams &params, ThreadPool *pool, const CancelToken *cancel = nullptr);
+
+Object CreateSurface(World *world);
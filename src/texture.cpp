@@ -36,6 +36,25 @@ Texture Texture::with_data(const uint8_t *buf, int w, int h, GLint format)
 
 
 
+// Single-channel float texture for lookup tables: no filtering, no mipmaps
+void Texture::set_float_data(const float *buf, int w, int h)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, buf);
+}
+
+void Texture::update_float_data(const float *buf, int w, int h)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RED, GL_FLOAT, buf);
+}
+
+
+
 Texture::Texture()
 {
     glGenTextures(1, &texture);
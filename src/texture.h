@@ -12,6 +12,8 @@ struct Texture {
 
     static std::optional<Texture> from_path(const std::string &path);
     Texture with_data(const uint8_t *buf, int w, int h, int format);
+    void set_float_data(const float *buf, int w, int h);
+    void update_float_data(const float *buf, int w, int h);
     Texture();
     ~Texture();
 };
\ No newline at end of file
@@ -0,0 +1,317 @@
+#include "threadpool.h"
+
+#include "trace.h"
+
+// Failed attempts at finding work before a worker goes to sleep
+#define SPIN_TRIES 64
+
+struct ThreadPool::Slot {
+    WorkDeque<PoolTask> deque;
+    ThreadPool *pool;
+    // Picks the first victim to steal from
+    uint32_t rng;
+    // External slots only, held by a Scope
+    bool external = false;
+    std::atomic<bool> claimed { false };
+};
+
+// The deque the calling thread pushes to, permanent on pool workers
+static thread_local ThreadPool::Slot *current_slot = nullptr;
+
+ThreadPool::ThreadPool(unsigned workers):
+    slots(new Slot[workers + EXTERNAL_SLOTS]), slot_count(workers + EXTERNAL_SLOTS)
+{
+    for (unsigned i = 0; i < slot_count; i++) {
+        slots[i].pool = this;
+        slots[i].rng = i * 2654435761u + 1;
+        slots[i].external = i >= workers;
+    }
+    for (unsigned i = 0; i < workers; i++)
+        this->workers.emplace_back([this, i]() { worker(&slots[i]); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quitting = true;
+    }
+    wake.notify_all();
+    for (auto &thread : workers)
+        thread.join();
+}
+
+ThreadPool &ThreadPool::shared()
+{
+    unsigned cores = std::thread::hardware_concurrency();
+    static ThreadPool pool(cores > 1 ? cores - 1 : 0);
+    return pool;
+}
+
+void ThreadPool::run(PoolTask *task)
+{
+    // The task may be gone as soon as it's counted down
+    std::atomic<unsigned> *remaining = task->remaining;
+    task->execute(task);
+    remaining->fetch_sub(1, std::memory_order_release);
+}
+
+PoolTask *ThreadPool::find_work(Slot *slot)
+{
+    if (PoolTask *task = slot->deque.pop())
+        return task;
+
+    slot->rng ^= slot->rng << 13;
+    slot->rng ^= slot->rng >> 17;
+    slot->rng ^= slot->rng << 5;
+    unsigned first = slot->rng % slot_count;
+    for (unsigned i = 0; i < slot_count; i++) {
+        Slot *victim = &slots[(first + i) % slot_count];
+        if (victim == slot)
+            continue;
+        if (PoolTask *task = victim->deque.steal())
+            return task;
+    }
+    return nullptr;
+}
+
+void ThreadPool::notify()
+{
+    // Ordered against the deque's bottom, like the sleeper's increment, so
+    // either it sees the new task or this sees it sleeping
+    if (!sleepers.load(std::memory_order_seq_cst))
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        wakeups++;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::worker(Slot *slot)
+{
+    current_slot = slot;
+    TraceThreadName("Worker");
+
+    unsigned idle = 0;
+    for (;;) {
+        if (PoolTask *task = find_work(slot)) {
+            idle = 0;
+            run(task);
+            continue;
+        }
+        if (++idle < SPIN_TRIES) {
+            std::this_thread::yield();
+            continue;
+        }
+        idle = 0;
+
+        std::unique_lock<std::mutex> guard(lock);
+        if (quitting)
+            return;
+        uint64_t seen = wakeups;
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        guard.unlock();
+
+        // Submitted between the last look and the increment
+        PoolTask *task = find_work(slot);
+
+        guard.lock();
+        if (!task)
+            wake.wait(guard, [&]() { return quitting || wakeups != seen; });
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+        guard.unlock();
+
+        if (task)
+            run(task);
+    }
+}
+
+
+
+ThreadPool::Scope::Scope(ThreadPool *pool):
+    pool(pool), outer(current_slot)
+{
+    if (outer && outer->pool == pool) {
+        slot = outer;
+        return;
+    }
+
+    for (unsigned i = pool->workers.size(); i < pool->slot_count; i++) {
+        Slot *external = &pool->slots[i];
+        if (!external->claimed.exchange(true, std::memory_order_acquire)) {
+            slot = external;
+            current_slot = slot;
+            break;
+        }
+    }
+}
+
+ThreadPool::Scope::~Scope()
+{
+    if (!slot || slot == outer)
+        return;
+    slot->claimed.store(false, std::memory_order_release);
+    current_slot = outer;
+}
+
+void ThreadPool::Scope::submit(PoolTask *task)
+{
+    slot->deque.push(task);
+    pool->notify();
+}
+
+void ThreadPool::Scope::wait(std::atomic<unsigned> *remaining)
+{
+    // Threads from outside the pool only help with their own work, so the
+    // frame waiting on a loop never ends up running part of a background
+    // job's, nor the other way around
+    while (remaining->load(std::memory_order_acquire)) {
+        PoolTask *task = slot->external ? slot->deque.pop() : pool->find_work(slot);
+        if (task)
+            run(task);
+        else
+            std::this_thread::yield();
+    }
+}
+
+
+
+// The right half of a split range, left for thieves while the splitting
+// thread works through the left half
+struct RangeTask : PoolTask {
+    ThreadPool *pool;
+    const ThreadPool::RangeFn *fn;
+    size_t begin, end, grain;
+    const CancelToken *cancel;
+};
+
+static void SplitRange(ThreadPool::Scope *scope, ThreadPool *pool, const ThreadPool::RangeFn &fn,
+    size_t begin, size_t end, size_t grain, const CancelToken *cancel);
+
+static void ExecuteRange(PoolTask *task)
+{
+    RangeTask *range = static_cast<RangeTask *>(task);
+    ThreadPool::Scope scope(range->pool);
+    SplitRange(&scope, range->pool, *range->fn, range->begin, range->end, range->grain, range->cancel);
+}
+
+static void SplitRange(ThreadPool::Scope *scope, ThreadPool *pool, const ThreadPool::RangeFn &fn,
+    size_t begin, size_t end, size_t grain, const CancelToken *cancel)
+{
+    if (end - begin > grain) {
+        std::atomic<unsigned> remaining { 1 };
+        RangeTask right;
+        right.execute = ExecuteRange;
+        right.remaining = &remaining;
+        right.pool = pool;
+        right.fn = &fn;
+        right.begin = begin + (end - begin) / 2;
+        right.end = end;
+        right.grain = grain;
+        right.cancel = cancel;
+        scope->submit(&right);
+
+        SplitRange(scope, pool, fn, begin, right.begin, grain, cancel);
+        scope->wait(&remaining);
+        return;
+    }
+
+    if (cancel && cancel->is_cancelled())
+        return;
+    TRACE_SCOPE("parallel_for");
+    fn(begin, end);
+}
+
+void ThreadPool::parallel_for(size_t count, size_t grain, const RangeFn &fn, const CancelToken *cancel)
+{
+    if (count == 0)
+        return;
+    if (grain == 0)
+        grain = 1;
+
+    Scope scope(this);
+    // Not worth waking anybody up for
+    if (workers.empty() || count <= grain || !scope.active()) {
+        if (!cancel || !cancel->is_cancelled())
+            fn(0, count);
+        return;
+    }
+
+    SplitRange(&scope, this, fn, 0, count, grain, cancel);
+}
+
+
+
+TaskGraph::Node TaskGraph::add(std::function<void ()> fn)
+{
+    tasks.emplace_back();
+    tasks.back().fn = std::move(fn);
+    return tasks.size() - 1;
+}
+
+void TaskGraph::precede(Node before, Node after)
+{
+    tasks[before].successors.push_back(&tasks[after]);
+    tasks[after].predecessors++;
+}
+
+void TaskGraph::execute(PoolTask *base)
+{
+    Task *task = static_cast<Task *>(base);
+    TaskGraph *graph = task->graph;
+    if (!graph->cancel || !graph->cancel->is_cancelled())
+        task->fn();
+
+    ThreadPool::Scope scope(graph->pool);
+    for (Task *next : task->successors) {
+        if (next->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            scope.submit(next);
+    }
+}
+
+void TaskGraph::run(ThreadPool *pool, const CancelToken *cancel)
+{
+    this->pool = pool;
+    this->cancel = cancel;
+
+    std::atomic<unsigned> remaining { (unsigned)tasks.size() };
+    for (Task &task : tasks) {
+        task.execute = execute;
+        task.remaining = &remaining;
+        task.graph = this;
+        task.pending.store(task.predecessors, std::memory_order_relaxed);
+    }
+
+    ThreadPool::Scope scope(pool);
+    if (!scope.active()) {
+        run_inline();
+        return;
+    }
+
+    for (Task &task : tasks) {
+        if (!task.predecessors)
+            scope.submit(&task);
+    }
+    scope.wait(&remaining);
+}
+
+void TaskGraph::run_inline()
+{
+    std::vector<Task *> ready;
+    for (Task &task : tasks) {
+        if (!task.predecessors)
+            ready.push_back(&task);
+    }
+
+    while (!ready.empty()) {
+        Task *task = ready.back();
+        ready.pop_back();
+        if (!cancel || !cancel->is_cancelled())
+            task->fn();
+        for (Task *next : task->successors) {
+            if (next->pending.fetch_sub(1, std::memory_order_relaxed) == 1)
+                ready.push_back(next);
+        }
+    }
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "funcref.h"
+#include "workdeque.h"
+
+// Stops work that hasn't started yet once cancelled. Work already running
+// finishes, or polls the token to stop early.
+struct CancelToken {
+    std::atomic<bool> cancelled { false };
+
+    void cancel()
+    {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    bool is_cancelled() const
+    {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+};
+
+// Unit of work for a ThreadPool. Whoever submits it owns it, and waits on
+// `remaining` for it to be done.
+struct PoolTask {
+    void (*execute)(PoolTask *task);
+    // Counted down once the task has run, after which it may be gone
+    std::atomic<unsigned> *remaining;
+};
+
+// Work-stealing pool. Every thread has its own deque of tasks: it runs the
+// newest of its own, and steals the oldest of someone else's when it runs
+// out. Threads waiting on work they submitted run tasks meanwhile, so
+// nested loops and graphs spread over the pool instead of deadlocking it;
+// threads from outside the pool only run tasks from their own deque.
+struct ThreadPool {
+    typedef FunctionRef<void (size_t begin, size_t end)> RangeFn;
+
+    // Threads from outside the pool that can submit work at once. Any
+    // more run their work inline.
+    static constexpr unsigned EXTERNAL_SLOTS = 4;
+
+    // A thread's deque, one per worker and per external slot
+    struct Slot;
+
+    explicit ThreadPool(unsigned workers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Shared pool with one thread per hardware core
+    static ThreadPool &shared();
+
+    // Number of threads a parallel_for runs on, counting the caller
+    unsigned concurrency() const
+    {
+        return workers.size() + 1;
+    }
+
+    // Calls fn over [0, count) in chunks of at most grain, returning once
+    // every chunk is done. The range is split in halves, so thieves take
+    // the biggest pieces left. Chunks not started by the time `cancel`
+    // fires are skipped.
+    void parallel_for(size_t count, size_t grain, const RangeFn &fn, const CancelToken *cancel = nullptr);
+
+    // Gives the calling thread a deque for as long as it lives, nested
+    // scopes share the outermost one. Without one, work has to run inline.
+    struct Scope {
+        explicit Scope(ThreadPool *pool);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+        bool active() const
+        {
+            return slot != nullptr;
+        }
+
+        // Queues `task` where idle threads can steal it
+        void submit(PoolTask *task);
+        // Runs tasks until `*remaining` reaches zero
+        void wait(std::atomic<unsigned> *remaining);
+
+    private:
+        ThreadPool *pool;
+        Slot *slot = nullptr;
+        Slot *outer;
+    };
+
+private:
+    std::unique_ptr<Slot[]> slots;
+    unsigned slot_count;
+    std::vector<std::thread> workers;
+
+    // Idle workers sleep until a submit bumps `wakeups`
+    std::mutex lock;
+    std::condition_variable wake;
+    std::atomic<unsigned> sleepers { 0 };
+    uint64_t wakeups = 0;
+    bool quitting = false;
+
+    void worker(Slot *slot);
+    PoolTask *find_work(Slot *slot);
+    void notify();
+    static void run(PoolTask *task);
+};
+
+// Tasks with dependencies between them, run on a ThreadPool. A graph can be
+// run any number of times, and must not have cycles.
+struct TaskGraph {
+    typedef uint32_t Node;
+
+    Node add(std::function<void ()> fn);
+    // `after` only starts once `before` has finished
+    void precede(Node before, Node after);
+
+    size_t size() const
+    {
+        return tasks.size();
+    }
+
+    // Returns once every task has run. Tasks that haven't started when
+    // `cancel` fires are skipped, but still release the ones after them.
+    void run(ThreadPool *pool, const CancelToken *cancel = nullptr);
+
+private:
+    struct Task : PoolTask {
+        std::function<void ()> fn;
+        std::vector<Task *> successors;
+        unsigned predecessors = 0;
+        std::atomic<unsigned> pending { 0 };
+        TaskGraph *graph;
+    };
+
+    // Stable addresses, tasks point at each other
+    std::deque<Task> tasks;
+    ThreadPool *pool = nullptr;
+    const CancelToken *cancel = nullptr;
+
+    static void execute(PoolTask *task);
+    void run_inline();
+};
@@ -0,0 +1,195 @@
+#include "trace.h"
+
+#ifdef TRACING
+
+#include <mutex>
+#include <vector>
+
+#include <imgui.h>
+#include <imgui_stdlib.h>
+
+// Buffers grow a chunk at a time up to a fixed limit, so the chunk table
+// never moves under a concurrent dump. Past the limit events are dropped.
+#define TRACE_CHUNK_EVENTS 8192
+#define TRACE_MAX_CHUNKS 256
+
+std::atomic_bool trace_enabled = false;
+
+struct TraceEvent {
+    const char *name;
+    int64_t ts_ns;
+    union {
+        int64_t dur_ns;
+        double value;
+    };
+    char phase;
+};
+
+struct TraceBuffer {
+    unsigned tid;
+    std::string thread_name;
+    std::atomic<TraceEvent *> chunks[TRACE_MAX_CHUNKS] = {};
+    // Events published so far, only ever written by the owning thread
+    std::atomic_size_t count = 0;
+    std::atomic_size_t dropped = 0;
+};
+
+static const TraceClock::time_point trace_epoch = TraceClock::now();
+
+// Buffers are never freed, so events outlive the threads that wrote them
+static std::mutex registry_lock;
+static std::vector<TraceBuffer *> registry;
+static thread_local TraceBuffer *local_buffer = nullptr;
+
+static TraceBuffer *LocalBuffer()
+{
+    if (!local_buffer) {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        local_buffer = new TraceBuffer;
+        local_buffer->tid = registry.size() + 1;
+        registry.push_back(local_buffer);
+    }
+    return local_buffer;
+}
+
+static void Append(const TraceEvent &event)
+{
+    TraceBuffer *buf = LocalBuffer();
+    size_t n = buf->count.load(std::memory_order_relaxed);
+    size_t chunk = n / TRACE_CHUNK_EVENTS;
+    if (chunk >= TRACE_MAX_CHUNKS) {
+        buf->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    TraceEvent *events = buf->chunks[chunk].load(std::memory_order_relaxed);
+    if (!events) {
+        events = new TraceEvent[TRACE_CHUNK_EVENTS];
+        buf->chunks[chunk].store(events, std::memory_order_release);
+    }
+    events[n % TRACE_CHUNK_EVENTS] = event;
+    buf->count.store(n + 1, std::memory_order_release);
+}
+
+static int64_t SinceEpoch(TraceClock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t - trace_epoch).count();
+}
+
+void TraceComplete(const char *name, TraceClock::time_point start, TraceClock::time_point end)
+{
+    TraceEvent event;
+    event.name = name;
+    event.ts_ns = SinceEpoch(start);
+    event.dur_ns = SinceEpoch(end) - event.ts_ns;
+    event.phase = 'X';
+    Append(event);
+}
+
+void TraceCounter(const char *name, double value)
+{
+    TraceEvent event;
+    event.name = name;
+    event.ts_ns = SinceEpoch(TraceClock::now());
+    event.value = value;
+    event.phase = 'C';
+    Append(event);
+}
+
+void TraceThreadName(const char *name)
+{
+    TraceBuffer *buf = LocalBuffer();
+    std::lock_guard<std::mutex> guard(registry_lock);
+    buf->thread_name = name;
+}
+
+size_t TraceEventCount()
+{
+    std::lock_guard<std::mutex> guard(registry_lock);
+    size_t total = 0;
+    for (TraceBuffer *buf : registry)
+        total += buf->count.load(std::memory_order_acquire);
+    return total;
+}
+
+static void WriteString(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', file);
+        if ((unsigned char)*str >= 0x20)
+            fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+bool TraceDump(const std::string &path)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) {
+        printf("Could not open trace at `%s` for writing!\n", path.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(registry_lock);
+
+    size_t written = 0, dropped = 0;
+    const char *sep = "\n";
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for (TraceBuffer *buf : registry) {
+        if (!buf->thread_name.empty()) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", sep, buf->tid);
+            WriteString(file, buf->thread_name.c_str());
+            fprintf(file, "}}");
+            sep = ",\n";
+        }
+
+        size_t count = buf->count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; i++) {
+            const TraceEvent *events = buf->chunks[i / TRACE_CHUNK_EVENTS].load(std::memory_order_acquire);
+            const TraceEvent &event = events[i % TRACE_CHUNK_EVENTS];
+
+            fprintf(file, "%s{\"name\":", sep);
+            WriteString(file, event.name);
+            fprintf(file, ",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f", event.phase, buf->tid, event.ts_ns / 1e3);
+            if (event.phase == 'X')
+                fprintf(file, ",\"dur\":%.3f}", event.dur_ns / 1e3);
+            else
+                fprintf(file, ",\"args\":{\"value\":%g}}", event.value);
+            sep = ",\n";
+        }
+        written += count;
+        dropped += buf->dropped.load(std::memory_order_relaxed);
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    printf("Wrote %zu trace events to `%s`", written, path.c_str());
+    if (dropped)
+        printf(", %zu more were dropped", dropped);
+    printf("\n");
+    return true;
+}
+
+void TraceDrawUI()
+{
+    static std::string path = "3yee.trace.json";
+
+    if (!ImGui::CollapsingHeader("Tracing"))
+        return;
+
+    bool enabled = TraceEnabled();
+    if (ImGui::Checkbox("Record", &enabled))
+        TraceSetEnabled(enabled);
+    ImGui::InputText("Trace Path", &path);
+    if (ImGui::Button("Save Trace"))
+        TraceDump(path);
+    ImGui::Text("%zu events recorded", TraceEventCount());
+
+    ImGui::Spacing();
+}
+
+#endif
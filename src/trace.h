@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+// Chrome/Perfetto trace-event recording. Every thread appends to its own
+// buffer without locking, and TraceDump() writes everything recorded so far
+// as JSON for chrome://tracing or ui.perfetto.dev. Configure with
+// -DTRACING=OFF to compile all of it out.
+
+typedef std::chrono::steady_clock TraceClock;
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+
+#ifdef TRACING
+
+extern std::atomic_bool trace_enabled;
+
+void TraceComplete(const char *name, TraceClock::time_point start, TraceClock::time_point end);
+void TraceCounter(const char *name, double value);
+void TraceThreadName(const char *name);
+size_t TraceEventCount();
+bool TraceDump(const std::string &path);
+void TraceDrawUI();
+
+inline bool TraceEnabled()
+{
+    return trace_enabled.load(std::memory_order_relaxed);
+}
+
+inline void TraceSetEnabled(bool enabled)
+{
+    trace_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+struct TraceScope {
+    const char *name;
+    TraceClock::time_point start;
+
+    TraceScope(const char *name):
+        name(name), start(TraceEnabled() ? TraceClock::now() : TraceClock::time_point())
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (start != TraceClock::time_point())
+            TraceComplete(name, start, TraceClock::now());
+    }
+};
+
+// `name` must outlive the trace, string literals are best
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(__trace_scope__, __LINE__) (name)
+#define TRACE_COUNTER(name, value) do { \
+        if (TraceEnabled()) \
+            TraceCounter(name, value); \
+    } while (0)
+
+#else
+
+inline bool TraceEnabled() { return false; }
+inline void TraceSetEnabled(bool) {}
+inline void TraceComplete(const char *, TraceClock::time_point, TraceClock::time_point) {}
+inline void TraceThreadName(const char *) {}
+inline size_t TraceEventCount() { return 0; }
+inline void TraceDrawUI() {}
+
+inline bool TraceDump(const std::string &)
+{
+    printf("This build has no tracing support!\n");
+    return false;
+}
+
+#define TRACE_SCOPE(name) (void)0
+#define TRACE_COUNTER(name, value) (void)0
+
+#endif
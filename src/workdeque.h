@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Chase-Lev work-stealing deque of pointers. The owning thread pushes and
+// pops at the bottom, any thread may steal from the top. Grows when full;
+// outgrown arrays are kept until the deque goes away, since a thief may
+// still be reading one.
+template <typename T>
+struct WorkDeque {
+    // `capacity` must be a power of two
+    explicit WorkDeque(size_t capacity = 256)
+    {
+        arrays.emplace_back(new Array(capacity));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkDeque(const WorkDeque &) = delete;
+    WorkDeque &operator=(const WorkDeque &) = delete;
+
+    // Owner only
+    void push(T *item)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array *a = array.load(std::memory_order_relaxed);
+        if (b - t >= (int64_t)a->size) {
+            a = grow(a, t, b);
+        }
+        a->put(b, item);
+        bottom.store(b + 1, std::memory_order_seq_cst);
+    }
+
+    // Owner only, newest first
+    T *pop()
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array *a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_seq_cst);
+
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        T *item = a->get(b);
+        if (t == b) {
+            // Last one, race any thief for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                item = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread, oldest first. Also returns nothing when it lost a race,
+    // so an empty result doesn't mean the deque is empty.
+    T *steal()
+    {
+        int64_t t = top.load(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_seq_cst);
+        if (t >= b)
+            return nullptr;
+
+        Array *a = array.load(std::memory_order_acquire);
+        T *item = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return item;
+    }
+
+    bool empty() const
+    {
+        return top.load(std::memory_order_seq_cst) >= bottom.load(std::memory_order_seq_cst);
+    }
+
+private:
+    struct Array {
+        size_t size;
+        std::unique_ptr<std::atomic<T *>[]> slots;
+
+        explicit Array(size_t size):
+            size(size), slots(new std::atomic<T *>[size])
+        {
+        }
+
+        T *get(int64_t i) const
+        {
+            return slots[i & (size - 1)].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T *item)
+        {
+            slots[i & (size - 1)].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    alignas(64) std::atomic<int64_t> top { 0 };
+    alignas(64) std::atomic<int64_t> bottom { 0 };
+    std::atomic<Array *> array;
+    // Owner only
+    std::vector<std::unique_ptr<Array>> arrays;
+
+    Array *grow(Array *a, int64_t t, int64_t b)
+    {
+        arrays.emplace_back(new Array(a->size * 2));
+        Array *bigger = arrays.back().get();
+        for (int64_t i = t; i < b; i++)
+            bigger->put(i, a->get(i));
+        array.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+};